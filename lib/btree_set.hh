@@ -0,0 +1,758 @@
+#ifndef PEQUOD_BTREE_SET_HH
+#define PEQUOD_BTREE_SET_HH 1
+#include "compiler.hh"
+#include "str.hh"
+#include "string.hh"
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <string.h>
+
+// An intrusive ordered set of T, where T::key() returns something
+// convertible to Str, stored in a B+tree with wide nodes. Every slot
+// caches the first 8 bytes of its key in big-endian order, so most
+// comparisons during a descent or a leaf scan never touch the T itself.
+// Implements the subset of boost::intrusive::set used by ServerStore.
+//
+// Unlike rbtree iterators, positions move when nodes split. Iterators
+// remember their element and reposition themselves if the tree changed
+// since they were created, so an iterator stays usable across unrelated
+// inserts and erases (but not across erasing its own element).
+//
+// Internodes count the elements below each child, so rank() and
+// distance() cost O(log n) rather than a walk over the range.
+//
+// If every key in the set starts with the same prefix (as do the keys of
+// a pequod subtable), set_key_prefix() makes the cached bytes start after
+// it, where keys actually differ. Lookups for keys outside the prefix
+// resolve to begin() or end() without a descent.
+
+template <typename T, int W> class btree_set;
+template <typename T, int W, typename V> class btree_iterator;
+template <typename T, int W> struct btree_internode;
+
+template <typename T, int W>
+struct btree_nodebase {
+    bool leaf_;
+    int n_;
+    btree_internode<T, W>* parent_;
+
+    inline btree_nodebase(bool leaf)
+        : leaf_(leaf), n_(0), parent_(nullptr) {
+    }
+};
+
+template <typename T, int W>
+struct btree_leaf : public btree_nodebase<T, W> {
+    uint64_t ikey_[W];
+    T* v_[W];
+    btree_leaf<T, W>* prev_;
+    btree_leaf<T, W>* next_;
+
+    inline btree_leaf()
+        : btree_nodebase<T, W>(true), prev_(nullptr), next_(nullptr) {
+    }
+};
+
+// internodes have room for one extra separator so an insertion can
+// overflow before the node splits
+template <typename T, int W>
+struct btree_internode : public btree_nodebase<T, W> {
+    uint64_t ikey_[W + 1];
+    String key_[W + 1];
+    btree_nodebase<T, W>* child_[W + 2];
+    size_t count_[W + 2];
+
+    inline btree_internode()
+        : btree_nodebase<T, W>(false) {
+    }
+    inline int child_index(const btree_nodebase<T, W>* c) const;
+    inline size_t size() const;
+};
+
+inline uint64_t btree_ikey(Str key, int skip = 0) {
+    union {
+        uint64_t u;
+        char c[8];
+    } x;
+    x.u = 0;
+    int len = key.length() - skip;
+    if (len > 0)
+        memcpy(x.c, key.data() + skip, len < 8 ? len : 8);
+    return net_to_host_order(x.u);
+}
+
+template <typename T, int W, typename V>
+class btree_iterator : public std::iterator<std::bidirectional_iterator_tag, V> {
+    typedef btree_set<T, W> tree_type;
+    typedef btree_leaf<T, W> leaf_type;
+  public:
+    inline btree_iterator() = default;
+    inline btree_iterator(const tree_type* tree, leaf_type* leaf, int pos);
+    template <typename VV>
+    inline btree_iterator(const btree_iterator<T, W, VV>& x);
+
+    inline V& operator*() const;
+    inline V* operator->() const;
+
+    inline btree_iterator<T, W, V>& operator++();
+    inline btree_iterator<T, W, V> operator++(int);
+    inline btree_iterator<T, W, V>& operator--();
+    inline btree_iterator<T, W, V> operator--(int);
+
+    template <typename VV>
+    inline bool operator==(const btree_iterator<T, W, VV>& x) const;
+    template <typename VV>
+    inline bool operator!=(const btree_iterator<T, W, VV>& x) const;
+
+  private:
+    const tree_type* tree_;
+    leaf_type* leaf_;
+    int pos_;
+    T* v_;
+    uint64_t vers_;
+
+    inline void revalidate();
+
+    template <typename TT, int WW, typename VV> friend class btree_iterator;
+    friend class btree_set<T, W>;
+};
+
+template <typename T, int W = 15>
+class btree_set {
+  public:
+    typedef T value_type;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef btree_iterator<T, W, T> iterator;
+    typedef btree_iterator<T, W, const T> const_iterator;
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+    typedef btree_leaf<T, W> leaf_type;
+    typedef btree_internode<T, W> internode_type;
+    typedef btree_nodebase<T, W> node_type;
+
+    struct insert_commit_data {
+        leaf_type* leaf;
+        int pos;
+        uint64_t vers;
+    };
+
+    inline btree_set();
+    ~btree_set();
+
+    inline bool empty() const;
+    inline size_t size() const;
+
+    inline iterator begin();
+    inline const_iterator begin() const;
+    inline iterator end();
+    inline const_iterator end() const;
+    inline reverse_iterator rbegin();
+    inline const_reverse_iterator rbegin() const;
+    inline reverse_iterator rend();
+    inline const_reverse_iterator rend() const;
+
+    template <typename K, typename Comp>
+    inline iterator lower_bound(const K& key, Comp compare);
+    template <typename K, typename Comp>
+    inline const_iterator lower_bound(const K& key, Comp compare) const;
+    template <typename K, typename Comp>
+    inline iterator find(const K& key, Comp compare);
+    template <typename K, typename Comp>
+    inline const_iterator find(const K& key, Comp compare) const;
+    template <typename K, typename Comp>
+    inline size_t count(const K& key, Comp compare) const;
+
+    inline iterator iterator_to(reference x);
+    inline const_iterator iterator_to(const_reference x) const;
+
+    template <typename K, typename Comp>
+    inline std::pair<iterator, bool>
+      insert_check(const K& key, Comp compare, insert_commit_data& cd);
+    template <typename K, typename Comp>
+    std::pair<iterator, bool>
+      insert_check(const_iterator hint, const K& key, Comp compare,
+                   insert_commit_data& cd);
+    iterator insert_commit(reference x, const insert_commit_data& cd);
+    inline iterator insert_before(const_iterator pos, reference x);
+
+    iterator erase(const_iterator it);
+    inline T* unlink_leftmost_without_rebalance();
+
+    size_t rank(const_iterator it) const;
+    inline size_t distance(const_iterator first, const_iterator last) const;
+
+    inline Str key_prefix() const;
+    inline void set_key_prefix(Str prefix);
+
+  private:
+    node_type* root_;
+    leaf_type* first_;
+    leaf_type* last_;
+    size_t size_;
+    uint64_t vers_;
+    String prefix_;
+
+    inline uint64_t ikey(Str key) const;
+
+    inline leaf_type* find_leaf(uint64_t ik, Str key) const;
+    static inline int leaf_lower_bound(const leaf_type* l, uint64_t ik, Str key);
+    inline std::pair<leaf_type*, int> locate(Str key) const;
+    inline iterator make_iterator(leaf_type* l, int pos) const;
+
+    static inline size_t subtree_size(const node_type* n);
+    static inline void adjust_counts(node_type* n, int delta);
+    static inline void fix_counts(node_type* n);
+    void insert_separator(node_type* left, node_type* right, Str key);
+    void remove_child(node_type* child);
+    void free_subtree(node_type* n);
+
+    btree_set(const btree_set<T, W>&) = delete;
+    btree_set<T, W>& operator=(const btree_set<T, W>&) = delete;
+
+    template <typename TT, int WW, typename VV> friend class btree_iterator;
+};
+
+
+template <typename T, int W>
+inline int btree_internode<T, W>::child_index(const btree_nodebase<T, W>* c) const {
+    int i = 0;
+    while (child_[i] != c)
+        ++i;
+    return i;
+}
+
+template <typename T, int W>
+inline size_t btree_internode<T, W>::size() const {
+    size_t x = 0;
+    for (int i = 0; i <= this->n_; ++i)
+        x += count_[i];
+    return x;
+}
+
+template <typename T, int W, typename V>
+inline btree_iterator<T, W, V>::btree_iterator(const tree_type* tree,
+                                               leaf_type* leaf, int pos)
+    : tree_(tree), leaf_(leaf), pos_(pos),
+      v_(leaf ? leaf->v_[pos] : nullptr), vers_(tree->vers_) {
+}
+
+template <typename T, int W, typename V> template <typename VV>
+inline btree_iterator<T, W, V>::btree_iterator(const btree_iterator<T, W, VV>& x)
+    : tree_(x.tree_), leaf_(x.leaf_), pos_(x.pos_), v_(x.v_), vers_(x.vers_) {
+}
+
+template <typename T, int W, typename V>
+inline V& btree_iterator<T, W, V>::operator*() const {
+    return *v_;
+}
+
+template <typename T, int W, typename V>
+inline V* btree_iterator<T, W, V>::operator->() const {
+    return v_;
+}
+
+template <typename T, int W, typename V>
+inline void btree_iterator<T, W, V>::revalidate() {
+    if (unlikely(vers_ != tree_->vers_)) {
+        if (v_) {
+            auto p = tree_->locate(v_->key());
+            leaf_ = p.first;
+            pos_ = p.second;
+        }
+        vers_ = tree_->vers_;
+    }
+}
+
+template <typename T, int W, typename V>
+inline auto btree_iterator<T, W, V>::operator++() -> btree_iterator<T, W, V>& {
+    revalidate();
+    if (++pos_ == leaf_->n_) {
+        leaf_ = leaf_->next_;
+        pos_ = 0;
+    }
+    v_ = leaf_ ? leaf_->v_[pos_] : nullptr;
+    return *this;
+}
+
+template <typename T, int W, typename V>
+inline auto btree_iterator<T, W, V>::operator++(int) -> btree_iterator<T, W, V> {
+    btree_iterator<T, W, V> old(*this);
+    ++*this;
+    return old;
+}
+
+template <typename T, int W, typename V>
+inline auto btree_iterator<T, W, V>::operator--() -> btree_iterator<T, W, V>& {
+    revalidate();
+    if (!leaf_)
+        leaf_ = tree_->last_, pos_ = leaf_->n_;
+    if (pos_ == 0)
+        leaf_ = leaf_->prev_, pos_ = leaf_->n_;
+    --pos_;
+    v_ = leaf_->v_[pos_];
+    return *this;
+}
+
+template <typename T, int W, typename V>
+inline auto btree_iterator<T, W, V>::operator--(int) -> btree_iterator<T, W, V> {
+    btree_iterator<T, W, V> old(*this);
+    --*this;
+    return old;
+}
+
+template <typename T, int W, typename V> template <typename VV>
+inline bool btree_iterator<T, W, V>::operator==(const btree_iterator<T, W, VV>& x) const {
+    return v_ == x.v_ && tree_ == x.tree_;
+}
+
+template <typename T, int W, typename V> template <typename VV>
+inline bool btree_iterator<T, W, V>::operator!=(const btree_iterator<T, W, VV>& x) const {
+    return v_ != x.v_ || tree_ != x.tree_;
+}
+
+
+template <typename T, int W>
+inline btree_set<T, W>::btree_set()
+    : size_(0), vers_(0) {
+    first_ = last_ = new leaf_type;
+    root_ = first_;
+}
+
+template <typename T, int W>
+btree_set<T, W>::~btree_set() {
+    free_subtree(root_);
+}
+
+template <typename T, int W>
+void btree_set<T, W>::free_subtree(node_type* n) {
+    if (!n->leaf_) {
+        internode_type* in = static_cast<internode_type*>(n);
+        for (int i = 0; i <= in->n_; ++i)
+            free_subtree(in->child_[i]);
+        delete in;
+    } else
+        delete static_cast<leaf_type*>(n);
+}
+
+template <typename T, int W>
+inline bool btree_set<T, W>::empty() const {
+    return size_ == 0;
+}
+
+template <typename T, int W>
+inline size_t btree_set<T, W>::size() const {
+    return size_;
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::make_iterator(leaf_type* l, int pos) const -> iterator {
+    if (pos == l->n_)
+        l = l->next_, pos = 0;
+    return iterator(this, l, pos);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::begin() -> iterator {
+    return make_iterator(first_, 0);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::begin() const -> const_iterator {
+    return make_iterator(first_, 0);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::end() -> iterator {
+    return iterator(this, nullptr, 0);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::end() const -> const_iterator {
+    return iterator(this, nullptr, 0);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::rbegin() -> reverse_iterator {
+    return reverse_iterator(end());
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::rbegin() const -> const_reverse_iterator {
+    return const_reverse_iterator(end());
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::rend() -> reverse_iterator {
+    return reverse_iterator(begin());
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::rend() const -> const_reverse_iterator {
+    return const_reverse_iterator(begin());
+}
+
+template <typename T, int W>
+inline Str btree_set<T, W>::key_prefix() const {
+    return prefix_;
+}
+
+template <typename T, int W>
+inline void btree_set<T, W>::set_key_prefix(Str prefix) {
+    assert(empty());
+    prefix_ = String(prefix);
+}
+
+template <typename T, int W>
+inline uint64_t btree_set<T, W>::ikey(Str key) const {
+    return btree_ikey(key, prefix_.length());
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::find_leaf(uint64_t ik, Str key) const -> leaf_type* {
+    node_type* n = root_;
+    while (!n->leaf_) {
+        internode_type* in = static_cast<internode_type*>(n);
+        int i = 0;
+        while (i != in->n_ && in->ikey_[i] < ik)
+            ++i;
+        while (i != in->n_ && in->ikey_[i] == ik && !(key < in->key_[i]))
+            ++i;
+        n = in->child_[i];
+    }
+    return static_cast<leaf_type*>(n);
+}
+
+template <typename T, int W>
+inline int btree_set<T, W>::leaf_lower_bound(const leaf_type* l, uint64_t ik, Str key) {
+    int i = 0;
+    while (i != l->n_ && l->ikey_[i] < ik)
+        ++i;
+    while (i != l->n_ && l->ikey_[i] == ik && l->v_[i]->key() < key)
+        ++i;
+    return i;
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::locate(Str key) const -> std::pair<leaf_type*, int> {
+    if (int plen = prefix_.length()) {
+        int c = memcmp(key.data(), prefix_.data(), std::min(key.length(), plen));
+        if (c < 0 || (c == 0 && key.length() < plen))
+            return std::make_pair(first_, 0);
+        else if (c > 0)
+            return std::make_pair(last_, last_->n_);
+    }
+    uint64_t ik = ikey(key);
+    leaf_type* l = find_leaf(ik, key);
+    return std::make_pair(l, leaf_lower_bound(l, ik, key));
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline auto btree_set<T, W>::lower_bound(const K& key, Comp) -> iterator {
+    auto p = locate(key);
+    return make_iterator(p.first, p.second);
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline auto btree_set<T, W>::lower_bound(const K& key, Comp) const -> const_iterator {
+    auto p = locate(key);
+    return make_iterator(p.first, p.second);
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline auto btree_set<T, W>::find(const K& key, Comp) -> iterator {
+    auto p = locate(key);
+    if (p.second != p.first->n_ && p.first->v_[p.second]->key() == Str(key))
+        return iterator(this, p.first, p.second);
+    return end();
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline auto btree_set<T, W>::find(const K& key, Comp compare) const -> const_iterator {
+    return const_cast<btree_set<T, W>*>(this)->find(key, compare);
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline size_t btree_set<T, W>::count(const K& key, Comp compare) const {
+    return find(key, compare) != end();
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::iterator_to(reference x) -> iterator {
+    auto p = locate(x.key());
+    assert(p.first->v_[p.second] == &x);
+    return iterator(this, p.first, p.second);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::iterator_to(const_reference x) const -> const_iterator {
+    return const_cast<btree_set<T, W>*>(this)->iterator_to(const_cast<reference>(x));
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+inline auto btree_set<T, W>::insert_check(const K& key, Comp, insert_commit_data& cd)
+    -> std::pair<iterator, bool> {
+    auto p = locate(key);
+    leaf_type* l = p.first;
+    if (p.second != l->n_ && l->v_[p.second]->key() == Str(key))
+        return std::make_pair(iterator(this, l, p.second), false);
+    cd.leaf = l;
+    cd.pos = p.second;
+    cd.vers = vers_;
+    return std::make_pair(make_iterator(l, p.second), true);
+}
+
+template <typename T, int W> template <typename K, typename Comp>
+auto btree_set<T, W>::insert_check(const_iterator hint, const K& key, Comp compare,
+                                   insert_commit_data& cd)
+    -> std::pair<iterator, bool> {
+    // The hint is usable if it still describes this tree and the key
+    // belongs in the hint's leaf: strictly after the previous element of
+    // the leaf (so it is past the leaf's separator) and no later than the
+    // hinted element (or the hinted leaf is the last one).
+    if (hint.tree_ == this && hint.vers_ == vers_) {
+        leaf_type* l = hint.leaf_ ? hint.leaf_ : last_;
+        int pos = hint.leaf_ ? hint.pos_ : l->n_;
+        Str k(key);
+        if ((pos ? l->v_[pos - 1]->key() < k : !l->prev_)
+            && (pos != l->n_ ? !(l->v_[pos]->key() < k) : !l->next_)) {
+            if (pos != l->n_ && l->v_[pos]->key() == k)
+                return std::make_pair(iterator(this, l, pos), false);
+            cd.leaf = l;
+            cd.pos = pos;
+            cd.vers = vers_;
+            return std::make_pair(make_iterator(l, pos), true);
+        }
+    }
+    return insert_check(key, compare, cd);
+}
+
+template <typename T, int W>
+auto btree_set<T, W>::insert_commit(reference x, const insert_commit_data& cd)
+    -> iterator {
+    Str key(x.key());
+    mandatory_assert(key.length() >= prefix_.length()
+                     && memcmp(key.data(), prefix_.data(), prefix_.length()) == 0);
+    uint64_t ik = ikey(key);
+    leaf_type* l = cd.leaf;
+    int pos = cd.pos;
+    if (cd.vers != vers_) {
+        l = find_leaf(ik, key);
+        pos = leaf_lower_bound(l, ik, key);
+    }
+    ++vers_;
+    ++size_;
+
+    if (l->n_ == W) {
+        // split. appending to the rightmost leaf leaves it full, which
+        // keeps time-ordered loads densely packed.
+        leaf_type* r = new leaf_type;
+        int mid = pos == W && !l->next_ ? W : (W + 1) / 2;
+        r->n_ = W - mid;
+        memcpy(r->ikey_, l->ikey_ + mid, sizeof(uint64_t) * r->n_);
+        memcpy(r->v_, l->v_ + mid, sizeof(T*) * r->n_);
+        l->n_ = mid;
+        r->prev_ = l;
+        r->next_ = l->next_;
+        if (r->next_)
+            r->next_->prev_ = r;
+        else
+            last_ = r;
+        l->next_ = r;
+        if (pos >= mid) {
+            l = r;
+            pos -= mid;
+        }
+        memmove(l->ikey_ + pos + 1, l->ikey_ + pos, sizeof(uint64_t) * (l->n_ - pos));
+        memmove(l->v_ + pos + 1, l->v_ + pos, sizeof(T*) * (l->n_ - pos));
+        l->ikey_[pos] = ik;
+        l->v_[pos] = &x;
+        ++l->n_;
+        insert_separator(r->prev_, r, r->v_[0]->key());
+        fix_counts(l);
+        return iterator(this, l, pos);
+    }
+
+    memmove(l->ikey_ + pos + 1, l->ikey_ + pos, sizeof(uint64_t) * (l->n_ - pos));
+    memmove(l->v_ + pos + 1, l->v_ + pos, sizeof(T*) * (l->n_ - pos));
+    l->ikey_[pos] = ik;
+    l->v_[pos] = &x;
+    ++l->n_;
+    adjust_counts(l, 1);
+    return iterator(this, l, pos);
+}
+
+template <typename T, int W>
+inline auto btree_set<T, W>::insert_before(const_iterator, reference x) -> iterator {
+    insert_commit_data cd;
+    auto p = insert_check(x.key(), 0, cd);
+    assert(p.second);
+    return insert_commit(x, cd);
+}
+
+template <typename T, int W>
+inline size_t btree_set<T, W>::subtree_size(const node_type* n) {
+    if (n->leaf_)
+        return n->n_;
+    return static_cast<const internode_type*>(n)->size();
+}
+
+template <typename T, int W>
+inline void btree_set<T, W>::adjust_counts(node_type* n, int delta) {
+    for (; n->parent_; n = n->parent_)
+        n->parent_->count_[n->parent_->child_index(n)] += delta;
+}
+
+template <typename T, int W>
+inline void btree_set<T, W>::fix_counts(node_type* n) {
+    for (; n->parent_; n = n->parent_)
+        n->parent_->count_[n->parent_->child_index(n)] = subtree_size(n);
+}
+
+template <typename T, int W>
+void btree_set<T, W>::insert_separator(node_type* left, node_type* right, Str key) {
+    internode_type* p = left->parent_;
+    if (!p) {
+        p = new internode_type;
+        p->child_[0] = left;
+        p->count_[0] = subtree_size(left);
+        left->parent_ = p;
+        root_ = p;
+    }
+
+    int i = p->child_index(left);
+    for (int j = p->n_; j != i; --j) {
+        p->ikey_[j] = p->ikey_[j - 1];
+        p->key_[j].swap(p->key_[j - 1]);
+        p->child_[j + 1] = p->child_[j];
+        p->count_[j + 1] = p->count_[j];
+    }
+    p->ikey_[i] = ikey(key);
+    p->key_[i] = String(key);
+    p->child_[i + 1] = right;
+    p->count_[i] = subtree_size(left);
+    p->count_[i + 1] = subtree_size(right);
+    right->parent_ = p;
+    ++p->n_;
+
+    if (p->n_ > W) {
+        // the middle separator moves up
+        internode_type* q = new internode_type;
+        int mid = p->n_ / 2;
+        q->n_ = p->n_ - mid - 1;
+        for (int j = 0; j != q->n_; ++j) {
+            q->ikey_[j] = p->ikey_[mid + 1 + j];
+            q->key_[j].swap(p->key_[mid + 1 + j]);
+        }
+        for (int j = 0; j <= q->n_; ++j) {
+            q->child_[j] = p->child_[mid + 1 + j];
+            q->count_[j] = p->count_[mid + 1 + j];
+            q->child_[j]->parent_ = q;
+        }
+        p->n_ = mid;
+        String up;
+        up.swap(p->key_[mid]);
+        insert_separator(p, q, up);
+    }
+}
+
+template <typename T, int W>
+void btree_set<T, W>::remove_child(node_type* child) {
+    internode_type* p = child->parent_;
+    if (p->n_ == 0) {
+        // p's only child is going away, so p goes too
+        remove_child(p);
+        delete p;
+        return;
+    }
+
+    int i = p->child_index(child);
+    int k = i ? i - 1 : 0;
+    for (int j = k; j != p->n_ - 1; ++j) {
+        p->ikey_[j] = p->ikey_[j + 1];
+        p->key_[j].swap(p->key_[j + 1]);
+    }
+    p->key_[p->n_ - 1] = String();
+    for (int j = i; j != p->n_; ++j) {
+        p->child_[j] = p->child_[j + 1];
+        p->count_[j] = p->count_[j + 1];
+    }
+    --p->n_;
+
+    if (p == root_ && p->n_ == 0) {
+        root_ = p->child_[0];
+        root_->parent_ = nullptr;
+        delete p;
+    }
+}
+
+template <typename T, int W>
+auto btree_set<T, W>::erase(const_iterator it) -> iterator {
+    leaf_type* l = it.leaf_;
+    int pos = it.pos_;
+    if (it.vers_ != vers_) {
+        auto p = locate(it.v_->key());
+        l = p.first;
+        pos = p.second;
+    }
+    assert(l && l->v_[pos] == it.v_);
+    ++vers_;
+    --size_;
+
+    --l->n_;
+    adjust_counts(l, -1);
+    memmove(l->ikey_ + pos, l->ikey_ + pos + 1, sizeof(uint64_t) * (l->n_ - pos));
+    memmove(l->v_ + pos, l->v_ + pos + 1, sizeof(T*) * (l->n_ - pos));
+
+    if (l->n_ == 0 && l != root_) {
+        leaf_type* next = l->next_;
+        if (l->prev_)
+            l->prev_->next_ = next;
+        else
+            first_ = next;
+        if (next)
+            next->prev_ = l->prev_;
+        else
+            last_ = l->prev_;
+        remove_child(l);
+        delete l;
+        return iterator(this, next, 0);
+    }
+    return make_iterator(l, pos);
+}
+
+template <typename T, int W>
+inline T* btree_set<T, W>::unlink_leftmost_without_rebalance() {
+    if (!size_)
+        return nullptr;
+    T* x = first_->v_[0];
+    erase(begin());
+    return x;
+}
+
+template <typename T, int W>
+size_t btree_set<T, W>::rank(const_iterator it) const {
+    if (!it.v_)
+        return size_;
+    const node_type* n = it.leaf_;
+    size_t r = it.pos_;
+    if (it.vers_ != vers_) {
+        auto p = locate(it.v_->key());
+        n = p.first;
+        r = p.second;
+    }
+    for (; n->parent_; n = n->parent_) {
+        const internode_type* p = n->parent_;
+        for (int i = 0; p->child_[i] != n; ++i)
+            r += p->count_[i];
+    }
+    return r;
+}
+
+template <typename T, int W>
+inline size_t btree_set<T, W>::distance(const_iterator first, const_iterator last) const {
+    return rank(last) - rank(first);
+}
+
+#endif
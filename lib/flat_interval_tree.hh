@@ -0,0 +1,583 @@
+#ifndef GSTORE_FLAT_INTERVAL_TREE_HH
+#define GSTORE_FLAT_INTERVAL_TREE_HH 1
+#include "interval_tree.hh"
+#include "str.hh"
+#include <algorithm>
+#include <vector>
+
+// An interval_tree with a flat index for point-stabbing queries.
+//
+// begin_contains(endpoint) is answered from a few static levels. Each
+// level packs the sorted, distinct endpoints of its intervals into one
+// buffer; the segments between them are the leaves of a static segment
+// tree kept in arrays, and each interval is listed, contiguously, at the
+// O(log n) nodes that exactly cover its segments. Stabbing a level is one
+// binary search plus a walk from a leaf to the root.
+//
+// New intervals go to a short delta list. When it fills, it becomes a
+// level, and levels are merged so their sizes fall geometrically: there
+// are O(log n) levels and each interval is re-indexed O(log n) times.
+// This happens in insert(), never in a query, and never while an
+// iterator is live. A level keeps its intervals, and each node its
+// entries, sorted by address, so erase() finds an interval's entries by
+// binary search and marks them dead in place by setting the pointer's low
+// bit. Dead entries are dropped when their level is merged, or all at
+// once when they outnumber the live ones.
+//
+// Endpoints must be string-like (data() and length()). Everything else
+// is served by the underlying interval_tree.
+
+template <typename T> class flat_contains_iterator;
+
+template <typename T>
+class flat_interval_tree {
+    typedef interval_tree<T> tree_type;
+  public:
+    typedef T value_type;
+    typedef typename T::endpoint_type endpoint_type;
+
+    inline flat_interval_tree();
+
+    inline bool empty() const;
+    inline size_t size() const;
+
+    template <typename X> inline value_type* find(const X &i);
+    template <typename X> inline const value_type* find(const X &i) const;
+
+    inline void insert(value_type& x);
+
+    inline void erase(value_type& x);
+    inline void erase_and_dispose(value_type& x);
+    template <typename Dispose> inline void erase_and_dispose(value_type& x, Dispose d);
+
+    typedef typename tree_type::const_iterator const_iterator;
+    typedef typename tree_type::iterator iterator;
+    inline const_iterator begin() const;
+    inline iterator begin();
+    inline const_iterator end() const;
+    inline iterator end();
+
+    template <typename X>
+    inline interval_contains_iterator<T, interval_interval_contains_predicate<interval<X> > >
+      begin_contains(const X& first, const X& last);
+    template <typename I>
+    inline interval_contains_iterator<T, interval_interval_contains_predicate<I> >
+      begin_contains(const I& x);
+    inline flat_contains_iterator<T> begin_contains(const endpoint_type& x);
+    template <typename X>
+    inline interval_contains_iterator<T, interval_interval_overlaps_predicate<interval<X> > >
+      begin_overlaps(const X& first, const X& last);
+    template <typename I>
+    inline interval_contains_iterator<T, interval_interval_overlaps_predicate<I> >
+      begin_overlaps(const I& x);
+
+    inline T* first_begin_after(const endpoint_type& x);
+
+    inline T* unlink_leftmost_without_rebalance();
+
+    inline void check();
+
+    template <typename TT> friend std::ostream &operator<<(std::ostream &s, const flat_interval_tree<TT> &x);
+
+  private:
+    enum { delta_max = 8, merge_ratio = 8 };
+
+    // a static segment tree over some of the intervals
+    struct level {
+        std::vector<char> boundbuf;
+        std::vector<uint32_t> bounds;   // offsets into boundbuf, plus end
+        size_t nleaves;                 // power of two >= # segments
+        std::vector<uint32_t> nodestart; // per node into items, plus end
+        std::vector<T*> items;
+        std::vector<T*> members;        // each interval, once
+
+        inline size_t nbounds() const;
+        inline Str bound(size_t i) const;
+        inline size_t lower_bound(Str x) const;
+        inline size_t leaf(Str x) const;
+        template <typename F> inline void cover(const T* x, F f) const;
+        void build();
+        bool kill(T* x);
+    };
+
+    tree_type t_;
+    size_t size_;                       // rbtree::size() walks the tree
+
+    std::vector<level> levels_;         // largest first
+    std::vector<T*> delta_;             // not yet in a level
+    size_t nindexed_;                   // in levels_, including dead
+    size_t ndead_;
+    int nlive_;                         // iterators holding the index
+
+    static inline T* dead(T* x);
+    static inline bool live(const T* x);
+    void remove(T* x);
+    void flush();
+    void compact();
+
+    friend class flat_contains_iterator<T>;
+};
+
+template <typename T>
+class flat_contains_iterator {
+  public:
+    inline flat_contains_iterator();
+    inline flat_contains_iterator(flat_interval_tree<T>* t, Str x);
+    inline flat_contains_iterator(const flat_contains_iterator<T>& x);
+    inline ~flat_contains_iterator();
+    flat_contains_iterator<T>& operator=(const flat_contains_iterator<T>& x);
+
+    template <typename X> inline bool operator==(const X& x) const {
+        return node_ == x.operator->();
+    }
+    template <typename X> inline bool operator!=(const X& x) const {
+        return node_ != x.operator->();
+    }
+
+    inline void operator++() {
+        advance();
+    }
+    inline void operator++(int) {
+        advance();
+    }
+
+    T& operator*() const {
+        return *node_;
+    }
+    T* operator->() const {
+        return node_;
+    }
+
+  private:
+    flat_interval_tree<T>* t_;
+    T* node_;
+    Str x_;
+    size_t level_;                      // levels_.size() in the delta
+    size_t node_index_;
+    size_t pos_;
+    size_t end_;
+
+    inline void enter();
+    void advance();
+    inline void release();
+};
+
+
+template <typename T>
+inline flat_interval_tree<T>::flat_interval_tree()
+    : size_(0), nindexed_(0), ndead_(0), nlive_(0) {
+}
+
+template <typename T>
+inline bool flat_interval_tree<T>::empty() const {
+    return t_.empty();
+}
+
+template <typename T>
+inline size_t flat_interval_tree<T>::size() const {
+    return size_;
+}
+
+template <typename T> template <typename X>
+inline T* flat_interval_tree<T>::find(const X &i) {
+    return t_.find(i);
+}
+
+template <typename T> template <typename X>
+inline const T* flat_interval_tree<T>::find(const X &i) const {
+    return t_.find(i);
+}
+
+template <typename T>
+inline void flat_interval_tree<T>::insert(T& x) {
+    t_.insert(x);
+    ++size_;
+    if (!(x.ibegin() < x.iend()))
+        return;
+    delta_.push_back(&x);
+    if (delta_.size() >= delta_max && !nlive_)
+        flush();
+}
+
+template <typename T>
+inline void flat_interval_tree<T>::erase(T& x) {
+    remove(&x);
+    --size_;
+    t_.erase(x);
+}
+
+template <typename T>
+inline void flat_interval_tree<T>::erase_and_dispose(T& x) {
+    remove(&x);
+    --size_;
+    t_.erase_and_dispose(x);
+}
+
+template <typename T> template <typename Disposer>
+inline void flat_interval_tree<T>::erase_and_dispose(T& x, Disposer d) {
+    remove(&x);
+    --size_;
+    t_.erase_and_dispose(x, d);
+}
+
+template <typename T>
+inline auto flat_interval_tree<T>::begin() const -> const_iterator {
+    return t_.begin();
+}
+
+template <typename T>
+inline auto flat_interval_tree<T>::begin() -> iterator {
+    return t_.begin();
+}
+
+template <typename T>
+inline auto flat_interval_tree<T>::end() const -> const_iterator {
+    return t_.end();
+}
+
+template <typename T>
+inline auto flat_interval_tree<T>::end() -> iterator {
+    return t_.end();
+}
+
+template <typename T> template <typename X>
+inline interval_contains_iterator<T, interval_interval_contains_predicate<interval<X> > >
+flat_interval_tree<T>::begin_contains(const X& first, const X& last) {
+    return t_.begin_contains(first, last);
+}
+
+template <typename T> template <typename I>
+inline interval_contains_iterator<T, interval_interval_contains_predicate<I> >
+flat_interval_tree<T>::begin_contains(const I& x) {
+    return t_.begin_contains(x);
+}
+
+template <typename T>
+inline flat_contains_iterator<T> flat_interval_tree<T>::begin_contains(const endpoint_type& x) {
+    return flat_contains_iterator<T>(this, x);
+}
+
+template <typename T> template <typename X>
+inline interval_contains_iterator<T, interval_interval_overlaps_predicate<interval<X> > >
+flat_interval_tree<T>::begin_overlaps(const X& first, const X& last) {
+    return t_.begin_overlaps(first, last);
+}
+
+template <typename T> template <typename I>
+inline interval_contains_iterator<T, interval_interval_overlaps_predicate<I> >
+flat_interval_tree<T>::begin_overlaps(const I& x) {
+    return t_.begin_overlaps(x);
+}
+
+template <typename T>
+inline T* flat_interval_tree<T>::first_begin_after(const endpoint_type& x) {
+    return t_.first_begin_after(x);
+}
+
+template <typename T>
+inline T* flat_interval_tree<T>::unlink_leftmost_without_rebalance() {
+    // only used to tear the tree down; the index is dropped wholesale
+    if (!levels_.empty() || !delta_.empty()) {
+        levels_.clear();
+        delta_.clear();
+        nindexed_ = ndead_ = 0;
+    }
+    T* x = t_.unlink_leftmost_without_rebalance();
+    if (x)
+        --size_;
+    return x;
+}
+
+template <typename T>
+inline void flat_interval_tree<T>::check() {
+    t_.check();
+}
+
+template <typename T>
+inline size_t flat_interval_tree<T>::level::nbounds() const {
+    return bounds.empty() ? 0 : bounds.size() - 1;
+}
+
+template <typename T>
+inline Str flat_interval_tree<T>::level::bound(size_t i) const {
+    return Str(boundbuf.data() + bounds[i], bounds[i + 1] - bounds[i]);
+}
+
+// index of the first endpoint >= x
+template <typename T>
+inline size_t flat_interval_tree<T>::level::lower_bound(Str x) const {
+    size_t l = 0, r = nbounds();
+    while (l < r) {
+        size_t m = l + (r - l) / 2;
+        if (bound(m) < x)
+            l = m + 1;
+        else
+            r = m;
+    }
+    return l;
+}
+
+// the leaf node for the segment holding x, or 0 if x is outside them all
+template <typename T>
+inline size_t flat_interval_tree<T>::level::leaf(Str x) const {
+    size_t i = lower_bound(x);
+    if (i < nbounds() && bound(i) == x)
+        ++i;
+    // x lies in segment i - 1, between bound(i - 1) and bound(i)
+    return i != 0 && i < nbounds() ? nleaves + i - 1 : 0;
+}
+
+// calls f(node) for each segment tree node that covers x exactly
+template <typename T> template <typename F>
+inline void flat_interval_tree<T>::level::cover(const T* x, F f) const {
+    size_t l = lower_bound(x->ibegin()), r = lower_bound(x->iend());
+    for (l += nleaves, r += nleaves; l < r; l >>= 1, r >>= 1) {
+        if (l & 1)
+            f(l++);
+        if (r & 1)
+            f(--r);
+    }
+}
+
+template <typename T>
+void flat_interval_tree<T>::level::build() {
+    std::vector<Str> ends;
+    ends.reserve(2 * members.size());
+    for (auto m : members) {
+        ends.push_back(m->ibegin());
+        ends.push_back(m->iend());
+    }
+    std::sort(ends.begin(), ends.end());
+    ends.erase(std::unique(ends.begin(), ends.end()), ends.end());
+
+    boundbuf.clear();
+    bounds.clear();
+    for (auto& e : ends) {
+        bounds.push_back(boundbuf.size());
+        boundbuf.insert(boundbuf.end(), e.data(), e.data() + e.length());
+    }
+    bounds.push_back(boundbuf.size());
+
+    // a leaf per segment, and one past the last endpoint
+    for (nleaves = 1; nleaves < nbounds(); nleaves <<= 1)
+        /* do nothing */;
+
+    // count, then place, each interval at its covering nodes
+    nodestart.assign(2 * nleaves + 1, 0);
+    for (auto m : members)
+        cover(m, [&](size_t n) { ++nodestart[n + 1]; });
+    for (size_t n = 0; n != 2 * nleaves; ++n)
+        nodestart[n + 1] += nodestart[n];
+
+    // members are sorted by address, so each node's items are too
+    std::vector<uint32_t> fill(nodestart.begin(), nodestart.end() - 1);
+    items.resize(nodestart.back());
+    for (auto m : members)
+        cover(m, [&](size_t n) { items[fill[n]++] = m; });
+}
+
+// marks x's entries dead; false if x is not live in this level
+template <typename T>
+bool flat_interval_tree<T>::level::kill(T* x) {
+    auto it = std::lower_bound(members.begin(), members.end(), x);
+    if (it == members.end() || *it != x)
+        return false;
+    *it = dead(x);
+    cover(x, [&](size_t n) {
+            auto nit = std::lower_bound(items.begin() + nodestart[n],
+                                        items.begin() + nodestart[n + 1], x);
+            assert(*nit == x);
+            *nit = dead(x);
+        });
+    return true;
+}
+
+// Dead entries keep their place in the address order, since a live
+// interval at x sorts between x - 1 and dead(x).
+template <typename T>
+inline T* flat_interval_tree<T>::dead(T* x) {
+    return reinterpret_cast<T*>(reinterpret_cast<uintptr_t>(x) | 1);
+}
+
+template <typename T>
+inline bool flat_interval_tree<T>::live(const T* x) {
+    return !(reinterpret_cast<uintptr_t>(x) & 1);
+}
+
+template <typename T>
+void flat_interval_tree<T>::remove(T* x) {
+    if (!(x->ibegin() < x->iend()))
+        return;
+    for (auto& d : delta_)
+        if (d == x) {
+            d = dead(x);
+            return;
+        }
+    for (auto& l : levels_)
+        if (l.kill(x)) {
+            ++ndead_;
+            return;
+        }
+}
+
+// Turns the delta into a level, then merges levels until each is more
+// than merge_ratio times the size of the next.
+template <typename T>
+void flat_interval_tree<T>::flush() {
+    if (ndead_ > delta_max && ndead_ > nindexed_ / 2) {
+        compact();
+        return;
+    }
+
+    levels_.emplace_back();
+    for (auto d : delta_)
+        if (live(d))
+            levels_.back().members.push_back(d);
+    delta_.clear();
+    nindexed_ += levels_.back().members.size();
+    while (levels_.size() > 1
+           && levels_[levels_.size() - 2].members.size()
+              <= merge_ratio * levels_.back().members.size()) {
+        level& to = levels_[levels_.size() - 2];
+        to.members.insert(to.members.end(), levels_.back().members.begin(),
+                          levels_.back().members.end());
+        levels_.pop_back();
+    }
+
+    level& l = levels_.back();
+    size_t n = l.members.size();
+    l.members.erase(std::remove_if(l.members.begin(), l.members.end(),
+                                   [](T* m) { return !live(m); }),
+                    l.members.end());
+    nindexed_ -= n - l.members.size();
+    ndead_ -= n - l.members.size();
+    std::sort(l.members.begin(), l.members.end());
+    if (l.members.empty())
+        levels_.pop_back();
+    else
+        l.build();
+}
+
+// Re-indexes every interval into one level.
+template <typename T>
+void flat_interval_tree<T>::compact() {
+    levels_.clear();
+    delta_.clear();
+
+    levels_.emplace_back();
+    level& l = levels_.back();
+    for (auto it = t_.begin(); it != t_.end(); ++it)
+        if (it->ibegin() < it->iend())
+            l.members.push_back(it.operator->());
+    std::sort(l.members.begin(), l.members.end());
+    nindexed_ = l.members.size();
+    ndead_ = 0;
+    if (l.members.empty())
+        levels_.pop_back();
+    else
+        l.build();
+}
+
+template <typename T>
+std::ostream &operator<<(std::ostream &s, const flat_interval_tree<T> &tree) {
+    return s << tree.t_;
+}
+
+
+template <typename T>
+inline flat_contains_iterator<T>::flat_contains_iterator()
+    : t_(nullptr), node_(nullptr) {
+}
+
+template <typename T>
+inline flat_contains_iterator<T>::flat_contains_iterator(flat_interval_tree<T>* t, Str x)
+    : t_(t), node_(nullptr), x_(x), level_(0) {
+    ++t_->nlive_;
+    enter();
+    advance();
+}
+
+template <typename T>
+inline flat_contains_iterator<T>::flat_contains_iterator(const flat_contains_iterator<T>& x)
+    : t_(x.t_), node_(x.node_), x_(x.x_), level_(x.level_),
+      node_index_(x.node_index_), pos_(x.pos_), end_(x.end_) {
+    if (t_)
+        ++t_->nlive_;
+}
+
+template <typename T>
+inline flat_contains_iterator<T>::~flat_contains_iterator() {
+    release();
+}
+
+template <typename T>
+flat_contains_iterator<T>& flat_contains_iterator<T>::operator=(const flat_contains_iterator<T>& x) {
+    if (x.t_)
+        ++x.t_->nlive_;
+    release();
+    t_ = x.t_;
+    node_ = x.node_;
+    x_ = x.x_;
+    level_ = x.level_;
+    node_index_ = x.node_index_;
+    pos_ = x.pos_;
+    end_ = x.end_;
+    return *this;
+}
+
+template <typename T>
+inline void flat_contains_iterator<T>::release() {
+    if (t_) {
+        --t_->nlive_;
+        t_ = nullptr;
+    }
+}
+
+// starts on level_ at the leaf holding x_, or at the top of the delta
+template <typename T>
+inline void flat_contains_iterator<T>::enter() {
+    node_index_ = pos_ = end_ = 0;
+    if (level_ != t_->levels_.size()) {
+        auto& l = t_->levels_[level_];
+        if ((node_index_ = l.leaf(x_))) {
+            pos_ = l.nodestart[node_index_];
+            end_ = l.nodestart[node_index_ + 1];
+        }
+    }
+}
+
+template <typename T>
+void flat_contains_iterator<T>::advance() {
+    while (t_ && level_ != t_->levels_.size()) {
+        auto& l = t_->levels_[level_];
+        // members of a node contain every key under it
+        if (pos_ != end_) {
+            T* n = l.items[pos_++];
+            if (flat_interval_tree<T>::live(n)) {
+                node_ = n;
+                return;
+            }
+        } else if (node_index_ > 1) {
+            node_index_ >>= 1;
+            pos_ = l.nodestart[node_index_];
+            end_ = l.nodestart[node_index_ + 1];
+        } else {
+            ++level_;
+            enter();
+        }
+    }
+
+    while (t_ && pos_ != t_->delta_.size()) {
+        T* n = t_->delta_[pos_++];
+        if (flat_interval_tree<T>::live(n)
+            && interval<Str>::contains(n->ibegin(), n->iend(), x_)) {
+            node_ = n;
+            return;
+        }
+    }
+
+    node_ = nullptr;
+    release();
+}
+
+#endif
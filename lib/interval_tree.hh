@@ -12,6 +12,13 @@ struct interval_comparator {
     }
 };
 
+struct interval_begin_comparator {
+    template <typename X, typename T>
+    inline int operator()(const X &x, const T &n) const {
+	return default_compare(x, n.ibegin());
+    }
+};
+
 struct interval_rb_reshaper {
     template <typename T>
     inline bool operator()(T* n) {
@@ -81,6 +88,8 @@ class interval_tree {
     inline interval_contains_iterator<T, interval_interval_overlaps_predicate<I> >
       end_overlaps(const I& x);
 
+    inline T* first_begin_after(const endpoint_type& x);
+
     inline T* unlink_leftmost_without_rebalance();
 
     inline void check();
@@ -135,6 +144,12 @@ inline void interval_tree<T>::erase_and_dispose(T& node, Disposer d) {
     t_.erase_and_dispose(node, d);
 }
 
+// the first interval, in tree order, that begins after x
+template <typename T>
+inline T* interval_tree<T>::first_begin_after(const endpoint_type& x) {
+    return t_.upper_bound(x, interval_begin_comparator()).operator->();
+}
+
 template <typename T>
 inline T* interval_tree<T>::unlink_leftmost_without_rebalance() {
     return t_.unlink_leftmost_without_rebalance();
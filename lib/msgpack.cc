@@ -206,6 +206,101 @@ const uint8_t* streaming_parser::consume(const uint8_t* first,
     return first;
 }
 
+const uint8_t* flat_array::parse(const uint8_t* first, const uint8_t* last,
+                                 const String& str) {
+    const uint8_t* start = first;
+    size_ = 0;
+    if (first == last || !format::is_fixarray(*first)
+        || *first - format::ffixarray > capacity)
+        return nullptr;
+    int n = *first - format::ffixarray;
+    ++first;
+
+    for (; size_ != n; ++size_) {
+        if (first == last)
+            return nullptr;
+        uint8_t type = *first;
+        uint32_t len;
+        if (format::is_fixint(type)) {
+            type_[size_] = t_int;
+            i_[size_] = int8_t(type);
+            ++first;
+            continue;
+        } else if (type == format::fnull) {
+            type_[size_] = t_null;
+            ++first;
+            continue;
+        } else if (format::is_fixstr(type)) {
+            len = type - format::ffixstr;
+            ++first;
+        } else if (type >= format::fuint8 && type <= format::fint64) {
+            int nb = nbytes[type - format::fnull];
+            if (last - first < nb)
+                return nullptr;
+            type_[size_] = t_int;
+            switch (type) {
+            case format::fuint8: i_[size_] = first[1]; break;
+            case format::fuint16: i_[size_] = read_in_net_order<uint16_t>(first + 1); break;
+            case format::fuint32: i_[size_] = read_in_net_order<uint32_t>(first + 1); break;
+            case format::fuint64: {
+                // leave values past INT64_MAX to the general parser
+                uint64_t x = read_in_net_order<uint64_t>(first + 1);
+                if (x > uint64_t(INT64_MAX))
+                    return nullptr;
+                i_[size_] = x;
+                break;
+            }
+            case format::fint8: i_[size_] = int8_t(first[1]); break;
+            case format::fint16: i_[size_] = read_in_net_order<int16_t>(first + 1); break;
+            case format::fint32: i_[size_] = read_in_net_order<int32_t>(first + 1); break;
+            default: i_[size_] = read_in_net_order<int64_t>(first + 1); break;
+            }
+            first += nb;
+            continue;
+        } else if (type == format::fstr8 || type == format::fbin8) {
+            if (last - first < 2)
+                return nullptr;
+            len = first[1];
+            first += 2;
+        } else if (type == format::fstr16 || type == format::fbin16) {
+            if (last - first < 3)
+                return nullptr;
+            len = read_in_net_order<uint16_t>(first + 1);
+            first += 3;
+        } else if (type == format::fstr32 || type == format::fbin32) {
+            if (last - first < 5)
+                return nullptr;
+            len = read_in_net_order<uint32_t>(first + 1);
+            first += 5;
+        } else
+            return nullptr;
+
+        if ((size_t) (last - first) < len)
+            return nullptr;
+        type_[size_] = t_string;
+        s_[size_].assign(reinterpret_cast<const char*>(first), len);
+        first += len;
+    }
+
+    if (str.ubegin() <= start && first <= str.uend())
+        str_ = str;
+    else
+        str_ = String();
+    return first;
+}
+
+Json flat_array::to_json() const {
+    Json j = Json::make_array_reserve(size_);
+    for (int i = 0; i != size_; ++i)
+        if (type_[i] == t_int)
+            j.push_back(i_[i]);
+        else if (type_[i] == t_string)
+            j.push_back(to_s(i));
+        else
+            j.push_back(Json());
+    return j;
+}
+
 parser& parser::operator>>(Str& x) {
     uint32_t len;
     if ((uint32_t) *s_ - format::ffixstr < format::nfixstr) {
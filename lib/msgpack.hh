@@ -150,7 +150,7 @@ inline char* write_double(char* s, double x) {
     *s++ = ffloat64;
     return write_in_net_order<double>(s, x);
 }
-inline char* write_string(char* s, const char *data, int len) {
+inline char* write_string_header(char* s, int len) {
     if (len < nfixstr)
         *s++ = 0xA0 + len;
     else if (len < 256) {
@@ -163,6 +163,10 @@ inline char* write_string(char* s, const char *data, int len) {
         *s++ = fstr32;
         s = write_in_net_order<uint32_t>(s, len);
     }
+    return s;
+}
+inline char* write_string(char* s, const char *data, int len) {
+    s = write_string_header(s, len);
     memcpy(s, data, len);
     return s + len;
 }
@@ -368,6 +372,40 @@ class streaming_parser {
     Json jokey_;
 };
 
+// Decodes a complete array of up to `capacity` integers, strings and nulls
+// without building a Json. Strings are Str views into the source buffer,
+// which the flat_array keeps a reference to. Anything else (nested
+// values, floats, truncated input) makes parse() return null, and the
+// caller should fall back to streaming_parser.
+class flat_array {
+  public:
+    enum { capacity = 8 };
+
+    inline flat_array();
+    inline void clear();
+
+    inline int size() const;
+    inline bool is_null(int i) const;
+    inline bool is_i(int i) const;
+    inline bool is_s(int i) const;
+    inline int64_t as_i(int i) const;
+    inline uint64_t to_u64(int i) const;
+    inline Str as_s(int i) const;
+    inline String to_s(int i) const;
+
+    const uint8_t* parse(const uint8_t* first, const uint8_t* last,
+                         const String& str);
+    Json to_json() const;
+
+  private:
+    enum { t_null = 0, t_int = 1, t_string = 2 };
+    int size_;
+    uint8_t type_[capacity];
+    int64_t i_[capacity];
+    Str s_[capacity];
+    String str_;
+};
+
 class parser {
   public:
     explicit inline parser(const char* s)
@@ -658,6 +696,54 @@ inline const Json& streaming_parser::result() const {
     return json_;
 }
 
+inline flat_array::flat_array()
+    : size_(0) {
+}
+
+inline void flat_array::clear() {
+    size_ = 0;
+    str_ = String();
+}
+
+inline int flat_array::size() const {
+    return size_;
+}
+
+inline bool flat_array::is_null(int i) const {
+    return i >= size_ || type_[i] == t_null;
+}
+
+inline bool flat_array::is_i(int i) const {
+    return i < size_ && type_[i] == t_int;
+}
+
+inline bool flat_array::is_s(int i) const {
+    return i < size_ && type_[i] == t_string;
+}
+
+inline int64_t flat_array::as_i(int i) const {
+    assert(is_i(i));
+    return i_[i];
+}
+
+inline uint64_t flat_array::to_u64(int i) const {
+    return is_i(i) && i_[i] > 0 ? i_[i] : 0;
+}
+
+inline Str flat_array::as_s(int i) const {
+    assert(is_s(i));
+    return s_[i];
+}
+
+inline String flat_array::to_s(int i) const {
+    if (!is_s(i))
+        return String();
+    else if (str_)
+        return str_.fast_substring(s_[i].begin(), s_[i].end());
+    else
+        return String(s_[i]);
+}
+
 inline parser& parser::operator>>(Json& j)  {
     using std::swap;
     streaming_parser sp;
@@ -124,6 +124,34 @@ void check_correctness() {
              "[9223372036854775808,-9223372036854775808]");
     }
 
+    {
+        StringAccum sa;
+        msgpack::unparser<StringAccum> up(sa);
+        up << msgpack::array(5) << 2 << 70000 << Str("t|a") << Json::null
+           << String::make_fill('x', 300);
+        String result = sa.take_string();
+        msgpack::flat_array fa;
+        assert(fa.parse(result.ubegin(), result.uend(), result) == result.uend());
+        assert(fa.size() == 5 && fa.as_i(0) == 2 && fa.as_i(1) == 70000);
+        assert(fa.as_s(2) == "t|a" && fa.is_null(3) && fa.as_s(4).length() == 300);
+        assert(fa.to_s(2).data() == fa.as_s(2).data());
+        assert(fa.to_json().unparse() == msgpack::parse(result).unparse());
+        assert(!fa.parse(result.ubegin(), result.uend() - 1, result));
+
+        up << msgpack::array(2) << 1 << Json::array(1);
+        result = sa.take_string();
+        assert(!fa.parse(result.ubegin(), result.uend(), result));
+
+        up << msgpack::array(2) << 1 << Json(uint64_t(1) << 63);
+        result = sa.take_string();
+        assert(!fa.parse(result.ubegin(), result.uend(), result));
+        up << msgpack::array(2) << 1 << Json(uint64_t(INT64_MAX));
+        result = sa.take_string();
+        assert(fa.parse(result.ubegin(), result.uend(), result) == result.uend());
+        assert(fa.as_i(1) == INT64_MAX);
+        assert(fa.to_json().unparse() == msgpack::parse(result).unparse());
+    }
+
     std::cout << "All tests pass!\n";
 }
 
@@ -78,8 +78,7 @@ uint32_t partition1::position(Str s) const {
 	    x = len <= prefix_len_ ? 0 : (unsigned char) data[prefix_len_];
     } else if ((type_ & type_mask) == binary) {
 	if (len >= prefix_len_ + 4)
-	    x = ntohl(*reinterpret_cast<const uint32_t *>(data + prefix_len_))
-		>> (32 - digits_);
+	    x = read_in_net_order<uint32_t>(data + prefix_len_) >> (32 - digits_);
     } else {
 	if (len >= prefix_len_ + digits_) {
 	    const char *edata = data + prefix_len_ + digits_;
@@ -121,7 +120,7 @@ int partition1::emit_pos(char *buf, uint32_t pp) const {
 	    buf[0] = pp;
 	    return 1;
 	} else if ((type_ & type_mask) == binary) {
-	    *reinterpret_cast<uint32_t *>(buf) = htonl(pp << (32 - digits_));
+	    write_in_net_order<uint32_t>(buf, pp << (32 - digits_));
 	    return 4;
 	} else {
 	    char *x = buf + digits_;
@@ -188,15 +187,23 @@ partition_set::partition_set(int default_server)
     p_.push_back(partition1(Str(), default_server));
 }
 
+// j is an array of partitions, or an object
+// {"partitions": [...], "replicated": [prefix, ...]}
 partition_set::partition_set(int default_server, const Json &j)
     : default_server_(default_server) {
     p_.push_back(partition1(Str(), default_server));
-    if (j.is_a())
-	for (Json::size_type i = 0; i != j.size(); ++i) {
-	    partition1 p = partition1::parse_json(j[i]);
+    const Json &parts = j.is_o() ? j.get("partitions") : j;
+    if (parts.is_a())
+	for (Json::size_type i = 0; i != parts.size(); ++i) {
+	    partition1 p = partition1::parse_json(parts[i]);
 	    if (!p.is_default())
 		add(p);
 	}
+    if (j.is_o() && j.get("replicated").is_a())
+	for (auto it = j.get("replicated").abegin();
+	     it != j.get("replicated").aend(); ++it)
+	    if (it->is_s())
+		add_replicated(it->as_s());
 }
 
 void partition_set::add(const partition1 &p) {
@@ -230,6 +237,26 @@ void partition_set::add(const partition1 &p) {
     }
 }
 
+void partition_set::add_replicated(Str prefix) {
+    auto it = std::lower_bound(replicated_.begin(), replicated_.end(), prefix);
+    if (it == replicated_.end() || *it != prefix)
+        replicated_.insert(it, String(prefix));
+}
+
+bool partition_set::is_replicated(Str key) const {
+    // any matching prefix sorts at or before key, among the entries
+    // sharing key's first character
+    auto it = std::upper_bound(replicated_.begin(), replicated_.end(), key);
+    while (it != replicated_.begin()) {
+        --it;
+        if (key.starts_with(*it))
+            return true;
+        if (!key.length() || (*it)[0] != key[0])
+            break;
+    }
+    return false;
+}
+
 partition_iterator partition_set::find(Str s) const {
     int pi_idx = 0;
     unsigned char s0 = (unsigned char) s[0];
@@ -396,7 +423,12 @@ Json partition_set::unparse_json() const {
     for (const partition1 *p1 = begin_p1(); p1 != end_p1(); ++p1)
 	if (!p1->is_default())
 	    j.push_back(p1->unparse_json());
-    return j;
+    if (replicated_.empty())
+	return j;
+    Json r = Json::make_array();
+    for (auto &prefix : replicated_)
+	r.push_back(prefix);
+    return Json().set("partitions", j).set("replicated", r);
 }
 
 String partition_set::unparse() const {
@@ -419,4 +451,29 @@ String Partitioner::unparse() const {
     return ps_.unparse();
 }
 
+// Returns the server that seqid should subscribe through to reach data
+// owned by owner. The cache servers form a fanout-ary tree rooted at the
+// owner, rotated by owner so that different owners load different relays.
+// Backing servers (and fanout <= 0) always go straight to the owner.
+int Partitioner::relay_parent(int owner, int seqid, int fanout) const {
+    int n = nhosts_ - nbacking_;
+    if (fanout <= 0 || seqid < nbacking_ || owner < 0 || n <= 0)
+        return owner;
+
+    int pos;
+    if (owner >= nbacking_)
+        pos = (seqid - owner + n) % n;
+    else
+        pos = (seqid - nbacking_ - owner % n + n) % n + 1;
+    assert(pos > 0);
+
+    int ppos = (pos - 1) / fanout;
+    if (ppos == 0)
+        return owner;
+    else if (owner >= nbacking_)
+        return nbacking_ + (owner - nbacking_ + ppos) % n;
+    else
+        return nbacking_ + (owner % n + ppos - 1) % n;
+}
+
 }
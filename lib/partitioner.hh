@@ -70,6 +70,11 @@ class partition_set {
 
     void add(const partition1 &p);
 
+    // keys under a replicated prefix are copied to every cache server
+    void add_replicated(Str prefix);
+    bool is_replicated(Str key) const;
+    inline const std::vector<String> &replicated() const;
+
     partition_iterator begin() const;
     partition_iterator end() const;
     partition_iterator find(Str s) const;
@@ -87,6 +92,7 @@ class partition_set {
     enum { first_finger = '`', nfingers = 32 };
     uint8_t finger_[nfingers];
     std::vector<partition1> p_;
+    std::vector<String> replicated_;
 
     inline const partition1 *begin_p1() const;
     inline const partition1 *end_p1() const;
@@ -136,6 +142,9 @@ class Partitioner {
     inline int rand_cache(std::default_random_engine& gen) const;
 
     inline bool is_backend(int seqid) const;
+    inline bool is_replicated(const String &key) const;
+    inline const std::vector<String> &replicated() const;
+    int relay_parent(int owner, int seqid, int fanout) const;
 
     static Partitioner *make(const String &name, uint32_t nhosts, uint32_t default_owner);
     static Partitioner *make(const String &name, uint32_t nbacking, uint32_t nhosts, uint32_t default_owner);
@@ -281,6 +290,11 @@ inline void partition_iterator::operator--() {
 }
 
 
+inline const std::vector<String> &partition_set::replicated() const {
+    return replicated_;
+}
+
+
 inline Partitioner::Partitioner(int default_owner, int nhosts, int nbacking)
     : nhosts_(nhosts), nbacking_(nbacking), ps_(default_owner) {
 }
@@ -307,5 +321,13 @@ inline bool Partitioner::is_backend(int seqid) const {
     return seqid < nbacking_;
 }
 
+inline bool Partitioner::is_replicated(const String &key) const {
+    return !ps_.replicated().empty() && ps_.is_replicated(key);
+}
+
+inline const std::vector<String> &Partitioner::replicated() const {
+    return ps_.replicated();
+}
+
 }
 #endif
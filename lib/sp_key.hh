@@ -2,6 +2,9 @@
 #define SP_KEY_HH_
 #include "straccum.hh"
 #include "str.hh"
+#include "compiler.hh"
+#include <type_traits>
+#include <string.h>
 #include <vector>
 #include <string>
 #include <sstream>
@@ -46,6 +49,61 @@ inline String make_spkey_last(const String &prefix, ARGS... args) {
     return sa.take_string();
 }
 
+// Binary spkeys write each field after the prefix as a fixed-width
+// big-endian unsigned integer, so byte order matches numeric order and
+// keys match join slots declared like <user:4n>.
+
+inline void append_binary_spkey(StringAccum &) {
+}
+
+template <typename T, typename... ARGS>
+inline void append_binary_spkey(StringAccum &sa, T x, ARGS... args) {
+    static_assert(std::is_unsigned<T>::value, "binary spkey fields must be unsigned");
+    char *s = sa.extend(sizeof(T) + 1);
+    *s = '|';
+    write_in_net_order<T>(s + 1, x);
+    append_binary_spkey(sa, args...);
+}
+
+template <typename... ARGS>
+inline String make_binary_spkey(Str prefix, ARGS... args) {
+    StringAccum sa(prefix.length() + 16);
+    sa << prefix;
+    append_binary_spkey(sa, args...);
+    return sa.take_string();
+}
+
+template <typename... ARGS>
+inline String make_binary_spkey_first(Str prefix, ARGS... args) {
+    StringAccum sa(prefix.length() + 16);
+    sa << prefix;
+    append_binary_spkey(sa, args...);
+    sa << '|';
+    return sa.take_string();
+}
+
+template <typename... ARGS>
+inline String make_binary_spkey_last(Str prefix, ARGS... args) {
+    StringAccum sa(prefix.length() + 16);
+    sa << prefix;
+    append_binary_spkey(sa, args...);
+    sa << '}';
+    return sa.take_string();
+}
+
+// Returns binary field number field (1 is the first field after the
+// prefix), assuming every field has type T. Returns 0 if the key is short.
+template <typename T>
+inline T extract_binary_spkey(int field, Str spkey) {
+    const char *s = reinterpret_cast<const char *>(memchr(spkey.data(), '|', spkey.length()));
+    if (!s || field < 1)
+        return 0;
+    s += (field - 1) * (sizeof(T) + 1) + 1;
+    if (s + sizeof(T) > spkey.end())
+        return 0;
+    return read_in_net_order<T>(s);
+}
+
 String extract_spkey(int field, const String &spkey);
 String extract_spkey(int field, const std::string &spkey);
 String extract_spkey(int field, Str spkey);
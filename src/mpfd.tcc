@@ -21,7 +21,7 @@ void msgpack_fd::construct() {
 
     wrelem_.push_back(wrelem());
     wrelem_.back().sa.reserve(wrcap);
-    wrelem_.back().pos = 0;
+    wrelem_.back().clear();
 }
 
 void msgpack_fd::initialize(tamer::fd rfd, tamer::fd wfd) {
@@ -60,6 +60,32 @@ msgpack_fd::~msgpack_fd() {
 }
 
 void msgpack_fd::write(const Json& j) {
+    StringAccum& sa = begin_write();
+    int old_len = sa.length();
+    write_json(sa, j);
+    end_write(sa.length() - old_len);
+}
+
+void msgpack_fd::write_json(StringAccum& sa, const Json& j) {
+    if (j.is_s())
+        write_string(j.as_s());
+    else if (j.is_a()) {
+        msgpack::unparser<StringAccum>(sa) << msgpack::array(j.size());
+        for (auto it = j.cabegin(); it != j.caend(); ++it)
+            write_json(sa, *it);
+    } else if (j.is_o()) {
+        msgpack::unparser<StringAccum>(sa) << msgpack::object(j.size());
+        for (auto it = j.cobegin(); it != j.coend(); ++it) {
+            msgpack::unparser<StringAccum>(sa) << it.key();
+            write_json(sa, it.value());
+        }
+    } else
+        msgpack::unparser<StringAccum>(sa) << j;
+}
+
+// Callers may unparse one message directly into the returned buffer,
+// then report its length with end_write().
+StringAccum& msgpack_fd::begin_write() {
     wrelem* w = &wrelem_.back();
     if (wrsize_ >= wrlowat_ && !wrblocked_)
         write_once();
@@ -67,12 +93,33 @@ void msgpack_fd::write(const Json& j) {
         wrelem_.push_back(wrelem());
         w = &wrelem_.back();
         w->sa.reserve(wrcap);
-        w->pos = 0;
+        w->clear();
     }
-    int old_len = w->sa.length();
-    msgpack::unparse(w->sa, j);
-    wrsize_ += w->sa.length() - old_len;
-    wrtotal_ += w->sa.length() - old_len;
+    return w->sa;
+}
+
+// Appends a msgpack string to the message being written. Long strings
+// are not copied: the buffer keeps a reference and writev() sends them
+// from their own memory. end_write() should count only the bytes added
+// to the StringAccum.
+void msgpack_fd::write_string(const String& str) {
+    wrelem& w = wrelem_.back();
+    if (str.length() < wrrefmin) {
+        char* x = w.sa.reserve(str.length() + 5);
+        w.sa.set_end(msgpack::format::write_string(x, str));
+    } else {
+        char* x = w.sa.reserve(5);
+        w.sa.set_end(msgpack::format::write_string_header(x, str.length()));
+        w.refs.push_back(wrref{w.sa.length(), str});
+        w.reflen += str.length();
+        wrsize_ += str.length();
+        wrtotal_ += str.length();
+    }
+}
+
+void msgpack_fd::end_write(size_t n) {
+    wrsize_ += n;
+    wrtotal_ += n;
     if (wrwake_)
         tamer::at_asap(std::move(wrwake_));
     assert(!wrwake_);
@@ -96,36 +143,41 @@ inline void msgpack_fd::check_coroutines() {
         wrwake_();
 }
 
+bool msgpack_fd::fill_rdbuf() {
+    assert(rdpos_ == rdlen_);
+    // make new buffer or reuse existing buffer
+    if (rdcap - rdpos_ < 4096) {
+        if (rdbuf_.is_shared())
+            rdbuf_ = String::make_uninitialized(rdcap);
+        rdpos_ = rdlen_ = 0;
+    }
+
+    ssize_t amt = ::read(rfd_.value(),
+                         const_cast<char*>(rdbuf_.data()) + rdpos_,
+                         rdcap - rdpos_);
+
+    if (amt != 0 && amt != (ssize_t) -1) {
+        rdlen_ += amt;
+        rdtotal_ += amt;
+        return true;
+    } else {
+        if (amt == 0)
+            rfd_.close();
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            rfd_.close(-errno);
+        rdquota_ = 0;
+        check_coroutines(); // wake up coroutine [if it's sleeping]
+        return false;
+    }
+}
+
 bool msgpack_fd::read_one_message() {
     assert(rdquota_ != 0);
 
  readmore:
     // if buffer empty, read more data
-    if (rdpos_ == rdlen_) {
-        // make new buffer or reuse existing buffer
-        if (rdcap - rdpos_ < 4096) {
-            if (rdbuf_.is_shared())
-                rdbuf_ = String::make_uninitialized(rdcap);
-            rdpos_ = rdlen_ = 0;
-        }
-
-        ssize_t amt = ::read(rfd_.value(),
-                             const_cast<char*>(rdbuf_.data()) + rdpos_,
-                             rdcap - rdpos_);
-
-        if (amt != 0 && amt != (ssize_t) -1) {
-            rdlen_ += amt;
-            rdtotal_ += amt;
-        } else {
-            if (amt == 0)
-                rfd_.close();
-            else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
-                rfd_.close(-errno);
-            rdquota_ = 0;
-            check_coroutines(); // wake up coroutine [if it's sleeping]
-            return false;
-        }
-    }
+    if (rdpos_ == rdlen_ && !fill_rdbuf())
+        return false;
 
     // process new data
     size_t amt = rdparser_.consume(rdbuf_.begin() + rdpos_,
@@ -143,6 +195,27 @@ bool msgpack_fd::read_one_message() {
         goto readmore;
 }
 
+// Decode the next request straight from the read buffer if it is a
+// complete flat array. Returns false, consuming nothing, if requests are
+// queued, a message is partially parsed, or the next message is a reply
+// or needs the general parser; use read_request() then.
+bool msgpack_fd::read_flat_request(msgpack::flat_array& req) {
+    if (!rdreqq_.empty() || !rdparser_.empty() || !rdquota_ || !rfd_
+        || (rdpos_ == rdlen_ && !fill_rdbuf()))
+        return false;
+    const uint8_t* end = req.parse(rdbuf_.ubegin() + rdpos_,
+                                   rdbuf_.ubegin() + rdlen_, rdbuf_);
+    if (!end || req.size() < 2 || !req.is_i(0) || req.as_i(0) < 0
+        || !req.is_i(1)) {
+        req.clear();
+        return false;
+    }
+    rdpos_ = end - rdbuf_.ubegin();
+    if (--rdquota_ == 0)
+        rdwake_();
+    return true;
+}
+
 tamed void msgpack_fd::reader_coroutine() {
     // NB The msgpack_fd::coroutines may outlive the msgpack_fd itself. They
     // are programmed to survive the deletion of the msgpack_fd by checking
@@ -219,32 +292,57 @@ void msgpack_fd::check() const {
     // document invariants
     assert(!wrelem_.empty());
     for (auto& w : wrelem_)
-        assert(w.pos <= w.sa.length());
+        assert(w.pos <= w.length());
     for (size_t i = 1; i < wrelem_.size(); ++i)
         assert(wrelem_[i].pos == 0);
     for (size_t i = 0; i + 1 < wrelem_.size(); ++i)
-        assert(wrelem_[i].pos < wrelem_[i].sa.length());
+        assert(wrelem_[i].pos < wrelem_[i].length());
     if (wrelem_.size() == 1)
-        assert(wrelem_[0].pos < wrelem_[0].sa.length()
-               || wrelem_[0].sa.empty());
+        assert(wrelem_[0].pos < wrelem_[0].length()
+               || wrelem_[0].length() == 0);
     size_t wrsize = 0;
     for (auto& w : wrelem_)
-        wrsize += w.sa.length() - w.pos;
+        wrsize += w.length() - w.pos;
     assert(wrsize == wrsize_);
 }
 
+void msgpack_fd::wrelem::clear() {
+    sa.clear();
+    refs.clear();
+    pos = reflen = 0;
+}
+
+// Fill at most n iovecs with this element's unwritten bytes.
+int msgpack_fd::wrelem::fill_iov(struct iovec* iov, int n) const {
+    int count = 0, sapos = 0;
+    size_t lpos = 0;
+    auto add = [&](const char* data, size_t len) {
+        if (len && lpos + len > pos && count != n) {
+            size_t skip = pos > lpos ? pos - lpos : 0;
+            iov[count].iov_base = const_cast<char*>(data) + skip;
+            iov[count].iov_len = len - skip;
+            ++count;
+        }
+        lpos += len;
+    };
+    for (auto& r : refs) {
+        add(sa.data() + sapos, r.offset - sapos);
+        add(r.str.data(), r.str.length());
+        sapos = r.offset;
+    }
+    add(sa.data() + sapos, sa.length() - sapos);
+    return count;
+}
+
 void msgpack_fd::write_once() {
     // check();
-    assert(!wrelem_.front().sa.empty());
-
-    struct iovec iov[3];
-    int iov_count = (wrelem_.size() > 3 ? 3 : (int) wrelem_.size());
-    size_t total = 0;
-    for (int i = 0; i != iov_count; ++i) {
-        iov[i].iov_base = wrelem_[i].sa.data() + wrelem_[i].pos;
-        iov[i].iov_len = wrelem_[i].sa.length() - wrelem_[i].pos;
-        total += iov[i].iov_len;
-    }
+    assert(wrelem_.front().length() != 0);
+
+    struct iovec iov[wriovmax];
+    int iov_count = 0;
+    for (auto it = wrelem_.begin();
+         it != wrelem_.end() && iov_count != wriovmax; ++it)
+        iov_count += it->fill_iov(iov + iov_count, wriovmax - iov_count);
 
     ssize_t amt;
     if (iov_count > 1)
@@ -257,15 +355,14 @@ void msgpack_fd::write_once() {
         wrpos_ += amt;
         wrsize_ -= amt;
         while (wrelem_.size() > 1
-               && amt >= wrelem_.front().sa.length() - wrelem_.front().pos) {
-            amt -= wrelem_.front().sa.length() - wrelem_.front().pos;
+               && (size_t) amt >= wrelem_.front().length() - wrelem_.front().pos) {
+            amt -= wrelem_.front().length() - wrelem_.front().pos;
             wrelem_.pop_front();
         }
         wrelem_.front().pos += amt;
-        if (wrelem_.front().pos == wrelem_.front().sa.length()) {
+        if (wrelem_.front().pos == wrelem_.front().length()) {
             assert(wrelem_.size() == 1);
-            wrelem_.front().sa.clear();
-            wrelem_.front().pos = 0;
+            wrelem_.front().clear();
         }
         while (!flushelem_.empty()
                && (ssize_t) (wrpos_ - flushelem_.front().wpos) >= 0) {
@@ -297,7 +394,7 @@ tamed void msgpack_fd::writer_coroutine() {
     kill = wrkill_ = tamer::make_event(rendez);
 
     while (kill && wfd_) {
-        if (wrelem_.size() == 1 && wrelem_.front().sa.empty())
+        if (wrelem_.size() == 1 && wrelem_.front().length() == 0)
             twait [description_] { wrwake_ = make_event(); }
         else if (wrblocked_) {
             twait [description_] { tamer::at_fd_write(wfd_.value(), make_event()); }
@@ -16,6 +16,25 @@ tamed void DirectClient::get(const String& key, event<String> e) {
         e(String());
 }
 
+tamed void DirectClient::get(const std::vector<String>& keys,
+                             event<std::vector<String> > e) {
+    tvars {
+        std::vector<String> values;
+        Table::iterator it;
+        size_t i;
+    }
+
+    values.reserve(keys.size());
+    for (i = 0; i != keys.size(); ++i) {
+        twait { server_.validate(keys[i], make_event(it)); }
+        if (it != it.table_end() && it->key() == keys[i])
+            values.push_back(it->value());
+        else
+            values.push_back(String());
+    }
+    e(std::move(values));
+}
+
 tamed void DirectClient::count(const String& first, const String& last,
                                event<size_t> e) {
     count(first, last, last, e);
@@ -30,7 +49,7 @@ tamed void DirectClient::count(const String& first, const String& last, const St
     twait [first + "," + last] {
         server_.validate(first, last, make_event(it));
     }
-    e(std::distance(it, server_.table_for(first, last).lower_bound(scanlast)));
+    e(server_.table_for(first, last).count(first, scanlast));
 }
 
 tamed void DirectClient::add_count(const String& first, const String& last,
@@ -47,7 +66,7 @@ tamed void DirectClient::add_count(const String& first, const String& last, cons
     twait [first + "," + last] {
         server_.validate(first, last, make_event(it));
     }
-    e(e.result() + std::distance(it, server_.table_for(first, last).lower_bound(scanlast)));
+    e(e.result() + server_.table_for(first, last).count(first, scanlast));
 }
 
 tamed void DirectClient::scan(const String& first, const String& last,
@@ -67,4 +86,16 @@ tamed void DirectClient::scan(const String& first, const String& last, const Str
     e(scan_result(it, server_.table_for(first, last).lower_bound(scanlast)));
 }
 
+tamed void DirectClient::rscan(const String& first, const String& last,
+                               size_t limit, event<rscan_result> e) {
+    tvars {
+        Table::iterator it;
+    }
+
+    twait [first + "," + last] {
+        server_.validate(first, last, make_event(it));
+    }
+    e(make_rscan_result(it, first, last, limit));
+}
+
 }
@@ -2,7 +2,11 @@
 #define PEQUOD_DATUM_HH
 #include <boost/intrusive/set.hpp>
 #include "pqbase.hh"
+#include "pqmemory.hh"
 #include "local_str.hh"
+#if HAVE_BTREE_STORE
+#include "btree_set.hh"
+#endif
 
 namespace pq {
 class Sink;
@@ -15,6 +19,14 @@ typedef boost::intrusive::set_member_hook<
     boost::intrusive::link_mode<boost::intrusive::normal_link>,
     boost::intrusive::optimize_size<true> > pequod_set_member_hook;
 
+#if HAVE_BTREE_STORE
+// btree_set keeps its links in its own nodes
+struct pequod_store_hook {
+};
+#else
+typedef pequod_set_base_hook pequod_store_hook;
+#endif
+
 template <typename T> class KeyHook {
   public:
     inline const T& key_holder() const {
@@ -22,7 +34,8 @@ template <typename T> class KeyHook {
     }
 };
 
-class Datum : public pequod_set_base_hook, public KeyHook<Datum> {
+class Datum : public pequod_store_hook, public KeyHook<Datum>,
+              public SlabAllocated {
   public:
     static const char table_marker[];
 
@@ -87,7 +100,34 @@ struct DatumDispose {
     }
 };
 
+#if HAVE_BTREE_STORE
+typedef btree_set<Datum> ServerStore;
+#else
 typedef boost::intrusive::set<Datum> ServerStore;
+#endif
+
+inline size_t store_distance(const ServerStore& store,
+                             ServerStore::const_iterator first,
+                             ServerStore::const_iterator last) {
+#if HAVE_BTREE_STORE
+    return store.distance(first, last);
+#else
+    (void) store;
+    return std::distance(first, last);
+#endif
+}
+
+// All keys stored in a table start with the table's name, which the
+// btree store skips when comparing keys. Datums still hold the full key:
+// key() is one contiguous Str that sinks, notifications and scan replies
+// keep, and holding only the suffix would mean rebuilding it on access.
+inline void store_set_key_prefix(ServerStore& store, Str prefix) {
+#if HAVE_BTREE_STORE
+    store.set_key_prefix(prefix);
+#else
+    (void) store, (void) prefix;
+#endif
+}
 
 
 inline bool operator<(const Datum& a, const Datum& b) {
@@ -1,5 +1,6 @@
 // -*- mode: c++ -*-
 #include "pqinterconnect.hh"
+#include "pqbase.hh"
 
 namespace pq {
 
@@ -8,11 +9,40 @@ tamed void Interconnect::subscribe(const String& first, const String& last,
     tvars { Json j; }
     twait ["subscribe " + first.substring(0, 2)] {
         fd_->call(Json::array(pq_subscribe, seq_, first, last,
-                              Json().set("subscriber", subscriber)),
+                              Json().set("subscriber", subscriber)
+                                    .set("compact", true)),
+                  make_event(j));
+        ++seq_;
+    }
+    e(scan_result(j && j[2].to_i() == pq_ok ? expand_scan(j[3])
+                  : Json::make_array()));
+}
+
+// Subscribes to every [bounds[i], bounds[i+1]) in one round trip.
+tamed void Interconnect::subscribe(const std::vector<String>& bounds,
+                                   int32_t subscriber,
+                                   event<std::vector<scan_result> > e) {
+    tvars {
+        Json j, req = Json::make_array_reserve(bounds.size());
+        std::vector<scan_result> res;
+    }
+
+    for (auto& b : bounds)
+        req.push_back(b);
+    twait ["subscribe batch"] {
+        fd_->call(Json::array(pq_subscribe_batch, seq_, std::move(req),
+                              Json().set("subscriber", subscriber)
+                                    .set("compact", true)),
                   make_event(j));
         ++seq_;
     }
-    e(scan_result(j && j[2].to_i() == pq_ok ? j[3] : Json::make_array()));
+
+    res.reserve(bounds.size() / 2);
+    for (size_t i = 0; i < bounds.size() / 2; ++i)
+        res.push_back(scan_result(j && j[2].to_i() == pq_ok
+                                  ? expand_scan(j[3].get(i))
+                                  : Json::make_array()));
+    e(std::move(res));
 }
 
 tamed void Interconnect::unsubscribe(const String& first, const String& last,
@@ -46,9 +76,42 @@ tamed void Interconnect::notify_erase(const String& key, event<> e) {
     e();
 }
 
+void Interconnect::notify(const String& key, const String& value) {
+    notifyq_[key] = value;
+    if (notifyq_.size() >= notify_batch)
+        flush_notify();
+    else if (!notify_scheduled_) {
+        notify_scheduled_ = true;
+        notify_timer();
+    }
+}
+
+void Interconnect::flush_notify() {
+    if (notifyq_.empty())
+        return;
+    Json batch = Json::make_array_reserve(2 * notifyq_.size());
+    for (auto it = notifyq_.begin(); it != notifyq_.end(); ++it)
+        if (is_erase_marker(it->second))
+            batch.push_back(it->first).push_back(Json());
+        else
+            batch.push_back(it->first).push_back(it->second);
+    notifyq_.clear();
+    fd_->call(Json::array(pq_notify_batch, seq_, std::move(batch)),
+              tamer::event<Json>());
+    ++seq_;
+}
+
+tamed void Interconnect::notify_timer() {
+    twait { tamer::at_delay_usec(notify_delay_usec, make_event()); }
+    notify_scheduled_ = false;
+    flush_notify();
+}
+
 tamed void Interconnect::invalidate(const String& first, const String& last,
                                     event<> e) {
     tvars { Json j; }
+    // pending notifications must not arrive after the invalidation
+    flush_notify();
     twait ["invalidate " + first.substring(0, 2)] {
         fd_->call(Json::array(pq_invalidate, seq_, first, last),
                   make_event(j));
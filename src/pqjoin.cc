@@ -151,6 +151,7 @@ void Join::clear() {
     }
     jvt_ = 0;
     maintained_ = true;
+    adaptive_ = false;
     filters_ = 0;
     lazy_ = 0;
 }
@@ -164,6 +165,7 @@ void Join::set_staleness(double s) {
         mandatory_assert(false && "Cannot unset staleness.");
     staleness_ = tous(s);
     maintained_ = false;
+    adaptive_ = false;
 }
 
 /** Expand @a pat into the first matching string that matches @a rm. */
@@ -410,6 +412,10 @@ int Join::parse_slot_name(Str word, ErrorHandler* errh) {
         slotlen_[slot] = nc;
     if (type != 0)
         slottype_[slot] = type;
+    if ((slottype_[slot] & stype_type_mask) == stype_binary_number
+        && slotlen_[slot] != 0 && slotlen_[slot] != 1 && slotlen_[slot] != 2
+        && slotlen_[slot] != 4 && slotlen_[slot] != 8)
+        return errh->error("binary number slot %<%p{String}%> must have length 1, 2, 4, or 8", &slotname_[slot]);
     return slot;
 }
 
@@ -476,6 +482,7 @@ int Join::hard_assign_parse(Str str, ErrorHandler* errh) {
     Str lastsourcestr;
     jvt_ = -1;
     maintained_ = true;
+    adaptive_ = false;
 
     int op = -1, any_op = -1, lazy = 0;
     for (unsigned i = 2; i != words.size(); ++i) {
@@ -502,9 +509,12 @@ int Join::hard_assign_parse(Str str, ErrorHandler* errh) {
         } else if (words[i] == "with" || words[i] == "where")
             new_op = jvt_slotdef;
         else if (words[i] == "pull")
-            maintained_ = false;
-        else if (words[i] == "push")
+            maintained_ = adaptive_ = false;
+        else if (words[i] == "push") {
             maintained_ = true;
+            adaptive_ = false;
+        } else if (words[i] == "adaptive")
+            maintained_ = adaptive_ = true;
         else if (words[i] == "and")
             /* do nothing */;
         else if (words[i] == "eager" || words[i] == "lazy") {
@@ -668,11 +678,27 @@ bool Join::assign_parse(Str str, ErrorHandler* errh) {
     return hard_assign_parse(str, errh) >= 0;
 }
 
+Json Join::unparse_slot(int slot, Str value) const {
+    // binary number slots hold big-endian integers
+    if ((slottype_[slot] & stype_type_mask) == stype_binary_number
+        && value.length() == slotlen_[slot]) {
+        if (value.length() == 1)
+            return Json((unsigned) value.udata()[0]);
+        else if (value.length() == 2)
+            return Json(read_in_net_order<uint16_t>(value.data()));
+        else if (value.length() == 4)
+            return Json(read_in_net_order<uint32_t>(value.data()));
+        else if (value.length() == 8)
+            return Json(read_in_net_order<uint64_t>(value.data()));
+    }
+    return Json(value);
+}
+
 Json Join::unparse_context(Str context) const {
     Json j;
     const uint8_t* ends = context.udata() + context.length();
     for (const uint8_t* s = context.udata(); s != ends; ) {
-        j.set(slotname_[*s], Str(s + 1, slotlen_[*s]));
+        j.set(slotname_[*s], unparse_slot(*s, Str(s + 1, slotlen_[*s])));
         s += slotlen_[*s] + 1;
     }
     return j;
@@ -682,7 +708,7 @@ Json Join::unparse_match(const Match& m) const {
     Json j;
     for (int s = 0; s != slot_capacity; ++s)
         if (m.has_slot(s))
-            j.set(slotname_[s], m.slot(s));
+            j.set(slotname_[s], unparse_slot(s, m.slot(s)));
     return j;
 }
 
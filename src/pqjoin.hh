@@ -157,6 +157,7 @@ class Join {
     String expand_last(const Pattern& pat, const RangeMatch& rm) const;
 
     inline bool maintained() const;
+    inline bool adaptive() const;
     inline uint64_t staleness() const;
     void set_staleness(double sec);
     inline JoinValueType jvt() const;
@@ -181,6 +182,7 @@ class Join {
     uint64_t staleness_;  // validated ranges can be used in this time window.
                         // staleness_ > 0 implies maintained_ == false
     bool maintained_;   // if the output is kept up to date with changes to the input
+    bool adaptive_;     // if each sink range picks push or pull from its workload
     uint8_t filters_;
     uint8_t lazy_;
     uint8_t slotlen_[slot_capacity];
@@ -202,6 +204,7 @@ class Join {
     int jvt_;
     Json jvtparam_;
 
+    Json unparse_slot(int slot, Str value) const;
     int parse_slot_name(Str word, ErrorHandler* errh);
     int parse_slot_names(Str word, String& out, ErrorHandler* errh);
     int hard_assign_parse(Str str, ErrorHandler* errh);
@@ -340,7 +343,8 @@ inline void Pattern::assign_optimized_match(Str str, int mopt, Match& m) const {
 }
 
 inline Join::Join()
-    : npat_(0), staleness_(0), maintained_(true), filters_(0), lazy_(0), 
+    : npat_(0), staleness_(0), maintained_(true), adaptive_(false),
+      filters_(0), lazy_(0), 
       refcount_(0), jvt_(jvt_copy_last), jvtparam_() {
 }
 
@@ -374,6 +378,10 @@ inline bool Join::maintained() const {
     return maintained_;
 }
 
+inline bool Join::adaptive() const {
+    return adaptive_;
+}
+
 inline uint64_t Join::staleness() const {
     return staleness_;
 }
@@ -41,6 +41,9 @@ static Clp_Option options[] = {
     { "round-robin", 0, 2008, Clp_ValInt, 0 },
     { "block-report", 0, 2009, Clp_ValInt, 0 },
     { "rand-cache", 0, 2010, 0, Clp_Negate },
+    { "relay-fanout", 0, 2011, Clp_ValInt, 0 },
+    { "refresh-ahead", 0, 2012, Clp_ValInt, 0 },
+    { "refresh-budget", 0, 2013, Clp_ValInt, 0 },
 
 
     // params that are generally useful to multiple apps
@@ -82,6 +85,7 @@ static Clp_Option options[] = {
     { "log-rtt", 0, 3035, 0, Clp_Negate },
     { "outpath", 0, 3036, Clp_ValString, 0 },
     { "timeout", 0, 3037, Clp_ValInt, 0 },
+    { "adaptive", 0, 3038, 0, Clp_Negate },
 
     // mostly twitter params
     { "shape", 0, 4000, Clp_ValDouble, 0 },
@@ -129,6 +133,8 @@ int main(int argc, char** argv) {
 
     int mode = mode_unknown, db = db_unknown;
     int listen_port = 8000, client_port = -1, nbacking = 0;
+    int relay_fanout = 0;
+    int refresh_ahead_ms = 0, refresh_budget_us = 1000;
     bool kill_old_server = false;
     String hostfile, dbhostfile, partfunc;
     pq::DBPoolParams db_param;
@@ -184,6 +190,12 @@ int main(int argc, char** argv) {
             block_report = clp->val.i;
         else if (clp->option->long_name == String("rand-cache"))
             tp_param.set("rand_cache", !clp->negated);
+        else if (clp->option->long_name == String("relay-fanout"))
+            relay_fanout = clp->val.i;
+        else if (clp->option->long_name == String("refresh-ahead"))
+            refresh_ahead_ms = clp->val.i;
+        else if (clp->option->long_name == String("refresh-budget"))
+            refresh_budget_us = clp->val.i;
 
         // general
         else if (clp->option->long_name == String("push"))
@@ -258,6 +270,8 @@ int main(int argc, char** argv) {
             tp_param.set("progress_report", !clp->negated);
         else if (clp->option->long_name == String("eager"))
             tp_param.set("eager", !clp->negated);
+        else if (clp->option->long_name == String("adaptive"))
+            tp_param.set("adaptive", !clp->negated);
         else if (clp->option->long_name == String("outpath"))
             tp_param.set("outpath", clp->val.s);
         else if (clp->option->long_name == String("timeout"))
@@ -386,6 +400,9 @@ int main(int argc, char** argv) {
             me = hosts->get_by_uid(pq::sock_helper::get_uid(hostname, listen_port));
         }
 
+        server.set_relay_fanout(relay_fanout);
+        server.set_refresh_details(uint64_t(refresh_ahead_ms) * 1000,
+                                   refresh_budget_us);
         server.set_eviction_details(mem_lo_mb, mem_hi_mb,
                                         evict_tomb, evict_rand, evict_multi, evict_pref_sink,
                                         evict_inline, evict_periodic);
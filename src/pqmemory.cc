@@ -1,5 +1,13 @@
 #include "pqmemory.hh"
 #include <cstdlib>
+#include <new>
+#include <unordered_map>
+#if HAVE_MALLOC_H
+# include <malloc.h>
+#endif
+#if HAVE_MALLOC_MALLOC_H
+# include <malloc/malloc.h>
+#endif
 
 namespace pq {
 
@@ -12,14 +20,94 @@ struct meminfo {
     uint64_t* type;
     size_t sz;
 };
+
+enum { slab_quantum = 16, slab_max_size = 512, slab_size = 65536 };
+
+struct slab_link {
+    slab_link* next;
+};
+
+struct slab_class {
+    slab_link* free;
+    char* pos;
+    char* limit;
+};
+
+slab_class slab_classes[slab_max_size / slab_quantum];
+
+#if !HAVE_MEMORY_HEADERS
+inline size_t usable_size(void* p) {
+# if HAVE_MALLOC_USABLE_SIZE
+    return malloc_usable_size(p);
+# else
+    return malloc_size(p);
+# endif
+}
+
+// The side table below must not allocate through operator new.
+template <typename T>
+struct malloc_allocator {
+    typedef T value_type;
+    malloc_allocator() = default;
+    template <typename U>
+    malloc_allocator(const malloc_allocator<U>&) {
+    }
+    T* allocate(size_t n) {
+        if (T* p = reinterpret_cast<T*>(malloc(n * sizeof(T))))
+            return p;
+        throw std::bad_alloc();
+    }
+    void deallocate(T* p, size_t) {
+        free(p);
+    }
+};
+template <typename T, typename U>
+inline bool operator==(const malloc_allocator<T>&, const malloc_allocator<U>&) {
+    return true;
+}
+template <typename T, typename U>
+inline bool operator!=(const malloc_allocator<T>&, const malloc_allocator<U>&) {
+    return false;
+}
+
+// Categories of allocations charged to a counter other than
+// mem_other_size. Those are rare, so a plain delete finds them here
+// rather than every allocation carrying its category. Built on first use
+// and never destroyed, as operator delete may run during static
+// destruction.
+typedef std::unordered_map<void*, uint64_t*, std::hash<void*>,
+                           std::equal_to<void*>,
+                           malloc_allocator<std::pair<void* const, uint64_t*> > >
+    typed_map;
+typed_map* typed_allocations;
+#endif
 }
 
+// Without headers, each allocation is charged its usable size as reported
+// by the allocator, which is also what we can recover when it is freed.
 void* allocate(size_t sz, uint64_t* type) {
     if (sz == 0)
         return NULL;
     if (!enable_memory_tracking)
         return malloc(sz);
 
+#if !HAVE_MEMORY_HEADERS
+    void* p = malloc(sz);
+    if (p) {
+        size_t usz = usable_size(p);
+        if (type && type != &mem_other_size) {
+            if (!typed_allocations) {
+                void* m = malloc(sizeof(typed_map));
+                mandatory_assert(m);
+                typed_allocations = new(m) typed_map;
+            }
+            (*typed_allocations)[p] = type;
+            *type += usz;
+        } else
+            mem_other_size += usz;
+    }
+    return p;
+#else
     size_t xsz = sz + sizeof(meminfo);
     meminfo* mi;
     if (xsz < sz || !(mi = (meminfo*)malloc(xsz)))
@@ -32,6 +120,7 @@ void* allocate(size_t sz, uint64_t* type) {
     else
         mem_other_size += sz;
     return (void *) (mi + 1);
+#endif
 }
 
 void deallocate(void* p) {
@@ -42,6 +131,18 @@ void deallocate(void* p) {
         return;
     }
 
+#if !HAVE_MEMORY_HEADERS
+    uint64_t* type = &mem_other_size;
+    if (typed_allocations && !typed_allocations->empty()) {
+        auto it = typed_allocations->find(p);
+        if (it != typed_allocations->end()) {
+            type = it->second;
+            typed_allocations->erase(it);
+        }
+    }
+    *type -= usable_size(p);
+    free(p);
+#else
     meminfo* mi = (meminfo*)p - 1;
     mem_overhead_size -= sizeof(meminfo);
     if (mi->type)
@@ -49,6 +150,66 @@ void deallocate(void* p) {
     else
         mem_other_size -= mi->sz;
     free(mi);
+#endif
+}
+
+// Free slots are never returned to malloc; a slab's unused bytes count
+// as overhead until they are handed out.
+void* slab_allocate(size_t sz, uint64_t* type) {
+    if (sz == 0 || sz > slab_max_size)
+        return allocate(sz, type);
+
+    size_t ci = (sz - 1) / slab_quantum;
+    size_t csz = (ci + 1) * slab_quantum;
+    slab_class& sc = slab_classes[ci];
+    void* p;
+    if (slab_link* l = sc.free) {
+        sc.free = l->next;
+        p = l;
+    } else {
+        if (sc.pos == sc.limit) {
+            char* slab = (char*)malloc(slab_size);
+            if (!slab)
+                return NULL;
+            sc.pos = slab;
+            sc.limit = slab + slab_size - slab_size % csz;
+            if (enable_memory_tracking)
+                mem_overhead_size += slab_size;
+        }
+        p = sc.pos;
+        sc.pos += csz;
+    }
+
+    if (enable_memory_tracking) {
+        mem_overhead_size -= sz;
+        if (type)
+            *type += sz;
+        else
+            mem_other_size += sz;
+    }
+    return p;
+}
+
+void slab_deallocate(void* p, size_t sz, uint64_t* type) {
+    if (!p)
+        return;
+    if (sz == 0 || sz > slab_max_size) {
+        deallocate(p);
+        return;
+    }
+
+    slab_class& sc = slab_classes[(sz - 1) / slab_quantum];
+    slab_link* l = (slab_link*)p;
+    l->next = sc.free;
+    sc.free = l;
+
+    if (enable_memory_tracking) {
+        mem_overhead_size += sz;
+        if (type)
+            *type -= sz;
+        else
+            mem_other_size -= sz;
+    }
 }
 
 } // namepace pq
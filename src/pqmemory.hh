@@ -5,13 +5,15 @@
 #include <memory>
 #include <cstddef>
 
-void* operator new(size_t, int64_t* type);
-void* operator new[](size_t, int64_t* type);
+void* operator new(size_t, uint64_t* type);
+void* operator new[](size_t, uint64_t* type);
 
 namespace pq {
 
 void* allocate(size_t, uint64_t* type);
 void deallocate(void* p);
+void* slab_allocate(size_t, uint64_t* type);
+void slab_deallocate(void* p, size_t, uint64_t* type);
 
 enum { enable_memory_tracking = 1 };
 
@@ -57,11 +59,25 @@ class Allocator {
 
     template <class U>
     struct rebind {
-        typedef Allocator<U> other;
+        typedef Allocator<U, mem_type> other;
     };
 };
 
 
+// Small, frequently churned objects (datums, ranges) inherit from
+// SlabAllocated. They are carved from per-size-class slabs rather than
+// malloc'ed one at a time, but are still charged to mem_other_size.
+class SlabAllocated {
+  public:
+    static inline void* operator new(size_t sz) {
+        return slab_allocate(sz, nullptr);
+    }
+    static inline void operator delete(void* p, size_t sz) {
+        slab_deallocate(p, sz, nullptr);
+    }
+};
+
+
 extern uint64_t mem_overhead_size;
 extern uint64_t mem_other_size;
 extern uint64_t mem_store_size;
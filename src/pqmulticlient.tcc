@@ -1,5 +1,6 @@
 // -*- mode: c++ -*-
 #include "pqmulticlient.hh"
+#include <map>
 
 namespace pq {
 
@@ -106,8 +107,48 @@ tamed void MultiClient::add_join(const String& first, const String& last,
     }
 }
 
+// reads of replicated keys are spread over the cache servers
 tamed void MultiClient::get(const String& key, event<String> e) {
-    cache_for(key)->get(key, e);
+    if (localNode_)
+        localNode_->get(key, e);
+    else
+        cache_for(key, part_->is_replicated(key))->get(key, e);
+}
+
+tamed void MultiClient::get(const std::vector<String>& keys,
+                            event<std::vector<String> > e) {
+    tvars {
+        std::vector<std::vector<String> > parts, results;
+        std::vector<int32_t> owner;
+        std::vector<size_t> pos;
+        std::vector<String> values;
+        uint32_t i;
+    }
+
+    if (localNode_)
+        localNode_->get(keys, e);
+    else {
+        // one batched request per server, sent in parallel
+        parts.resize(clients_.size());
+        owner.reserve(keys.size());
+        for (i = 0; i < keys.size(); ++i) {
+            owner.push_back(cache_owner(keys[i], part_->is_replicated(keys[i])));
+            parts[owner.back()].push_back(keys[i]);
+        }
+
+        results.resize(clients_.size());
+        twait ["multiget"] {
+            for (i = 0; i < clients_.size(); ++i)
+                if (!parts[i].empty())
+                    clients_[i]->get(parts[i], make_event(results[i]));
+        }
+
+        values.reserve(keys.size());
+        pos.assign(clients_.size(), 0);
+        for (i = 0; i < keys.size(); ++i)
+            values.push_back(std::move(results[owner[i]][pos[owner[i]]++]));
+        e(std::move(values));
+    }
 }
 
 tamed void MultiClient::insert(const String& key, const String& value, event<> e) {
@@ -176,6 +217,142 @@ tamed void MultiClient::scan(const String& first, const String& last,
     cache_for(first, rand_cache_)->scan(first, last, scanlast, e);
 }
 
+tamed void MultiClient::scan(const String& first, const String& last,
+                             const String& scanlast, size_t limit,
+                             event<scan_result> e) {
+    cache_for(first, rand_cache_)->scan(first, last, scanlast, limit, e);
+}
+
+tamed void MultiClient::rscan(const String& first, const String& last,
+                              size_t limit, event<rscan_result> e) {
+    cache_for(first, rand_cache_)->rscan(first, last, limit, e);
+}
+
+// Assigns each op of a batch an owner and a phase. Ops in one phase go
+// out together, one sub-batch per owner, and each owner runs its
+// sub-batch in order. An op waits for a later phase only when an earlier
+// op on another owner wrote what it touches, or read what it writes.
+// Reads that would be spread over caches or replicas go to the owner
+// once an earlier op in the batch wrote into what they read.
+uint32_t MultiClient::plan_multi(const Json& ops, std::vector<int32_t>& owner,
+                                 std::vector<uint32_t>& phase) {
+    struct access {
+        int32_t owner;          // -1 if several owners
+        uint32_t phase;
+        void merge(int32_t o, uint32_t p) {
+            if (owner != o)
+                owner = -1;
+            phase = std::max(phase, p);
+        }
+    };
+    struct range_read {
+        String first, last;
+        access a;
+    };
+    std::map<String, access> written, read;
+    std::vector<range_read> scanned;
+    std::vector<uint32_t> owner_phase(clients_.size(), 0);
+    uint32_t nphases = 1;
+
+    owner.clear();
+    phase.clear();
+    for (size_t i = 0; i < ops.size(); ++i) {
+        const Json& op = ops[i];
+        if (!op[1].is_s()) {
+            owner.push_back(0);
+            phase.push_back(owner_phase[0]);
+            continue;
+        }
+
+        String first = op[1].as_s();
+        int32_t cmd = op[0].to_i();
+        bool is_range = cmd >= pq_count;
+        bool is_write = cmd == pq_insert || cmd == pq_erase;
+        String last = is_range && op[2].is_s() ? op[2].as_s() : first;
+
+        // earlier writes into [first, last], or to first for a point op
+        auto wit = written.lower_bound(first), wend = wit;
+        while (wend != written.end()
+               && (is_range ? wend->first < last : wend->first == first))
+            ++wend;
+
+        bool spread = (rand_cache_ && is_range)
+            || (cmd == pq_get && part_->is_replicated(first));
+        int32_t o = cache_owner(first, spread && wit == wend);
+
+        uint32_t p = owner_phase[o];
+        for (; wit != wend; ++wit)
+            if (wit->second.owner != o)
+                p = std::max(p, wit->second.phase + 1);
+        if (is_write) {
+            auto rit = read.find(first);
+            if (rit != read.end() && rit->second.owner != o)
+                p = std::max(p, rit->second.phase + 1);
+            for (auto& r : scanned)
+                if (r.a.owner != o && r.first <= first && first < r.last)
+                    p = std::max(p, r.a.phase + 1);
+        }
+
+        if (is_write) {
+            auto it = written.insert(std::make_pair(first, access{o, p})).first;
+            it->second.merge(o, p);
+        } else if (!is_range) {
+            auto it = read.insert(std::make_pair(first, access{o, p})).first;
+            it->second.merge(o, p);
+        } else
+            scanned.push_back(range_read{first, last, access{o, p}});
+
+        owner_phase[o] = p;
+        nphases = std::max(nphases, p + 1);
+        owner.push_back(o);
+        phase.push_back(p);
+    }
+    return nphases;
+}
+
+tamed void MultiClient::multi(const Json& ops, event<Json> e) {
+    tvars {
+        std::vector<Json> parts, results;
+        std::vector<int32_t> owner;
+        std::vector<uint32_t> phase;
+        std::vector<size_t> pos;
+        Json rj;
+        uint32_t i, p, nphases;
+    }
+
+    if (localNode_)
+        localNode_->multi(ops, e);
+    else {
+        nphases = plan_multi(ops, owner, phase);
+        rj = Json::make_array_reserve(ops.size());
+        for (i = 0; i < ops.size(); ++i)
+            rj.push_back(Json());
+
+        for (p = 0; p != nphases; ++p) {
+            parts.assign(clients_.size(), Json());
+            for (i = 0; i < ops.size(); ++i)
+                if (phase[i] == p) {
+                    if (!parts[owner[i]])
+                        parts[owner[i]] = Json::make_array();
+                    parts[owner[i]].push_back(ops[i]);
+                }
+
+            results.assign(clients_.size(), Json());
+            twait ["multi"] {
+                for (i = 0; i < clients_.size(); ++i)
+                    if (parts[i])
+                        clients_[i]->multi(parts[i], make_event(results[i]));
+            }
+
+            pos.assign(clients_.size(), 0);
+            for (i = 0; i < ops.size(); ++i)
+                if (phase[i] == p)
+                    rj[i] = results[owner[i]].get(pos[owner[i]]++);
+        }
+        e(std::move(rj));
+    }
+}
+
 tamed void MultiClient::stats(event<Json> e) {
     tvars {
         Json j;
@@ -1,4 +1,5 @@
 #include "partitioner.hh"
+#include "json.hh"
 
 namespace pq {
 
@@ -71,6 +72,20 @@ TwitterPartitioner::TwitterPartitioner(uint32_t nservers, uint32_t nbacking,
 }
 
 
+// configured from partition_set JSON, given in place of a name
+class JsonPartitioner : public Partitioner {
+  public:
+    JsonPartitioner(uint32_t nservers, uint32_t nbacking, uint32_t default_owner,
+                    const Json& j);
+};
+
+JsonPartitioner::JsonPartitioner(uint32_t nservers, uint32_t nbacking,
+                                 uint32_t default_owner, const Json& j)
+    : Partitioner(default_owner, nservers, nbacking) {
+    ps_ = partition_set(default_owner, j);
+}
+
+
 class HackerNewsPartitioner : public Partitioner {
   public:
     HackerNewsPartitioner(uint32_t nservers, uint32_t nbacking, uint32_t default_owner);
@@ -97,7 +112,9 @@ Partitioner *Partitioner::make(const String &name, uint32_t nservers,
 
 Partitioner *Partitioner::make(const String &name, uint32_t nbacking,
                                uint32_t nservers, uint32_t default_owner) {
-    if (name == "default" || nservers == 1)
+    if (name && (name[0] == '{' || name[0] == '['))
+        return new JsonPartitioner(nservers, nbacking, default_owner, Json::parse(name));
+    else if (name == "default" || nservers == 1)
         return new DefaultPartitioner(nservers);
     else if (name == "unit")
         return new UnitTestPartitioner(nservers, default_owner);
@@ -29,6 +29,20 @@ tamed void RemoteClient::get(const String& key, event<String> e) {
     e(j && j[2].to_i() == pq_ok ? j[3].to_s() : String());
 }
 
+tamed void RemoteClient::get(const std::vector<String>& keys,
+                             event<std::vector<String> > e) {
+    tvars { Json ops = Json::make_array_reserve(keys.size()), j; size_t i; }
+    for (i = 0; i != keys.size(); ++i)
+        ops.push_back(Json::array(pq_get, keys[i]));
+    twait { multi(ops, make_event(j)); }
+
+    std::vector<String> values;
+    values.reserve(keys.size());
+    for (i = 0; i != keys.size(); ++i)
+        values.push_back(j[i].to_s());
+    e(std::move(values));
+}
+
 tamed void RemoteClient::noop_get(const String& key, event<String> e) {
     tvars { Json j; unsigned long seq = this->seq_; }
     twait [twait_description("noop_get", key)] {
@@ -59,6 +73,20 @@ tamed void RemoteClient::erase(const String& key, event<> e) {
     e();
 }
 
+tamed void RemoteClient::insert_batch(const std::vector<std::pair<String, String> >& kvs,
+                                      event<> e) {
+    tvars { Json j, batch; unsigned long seq = this->seq_; }
+    batch = Json::make_array_reserve(2 * kvs.size());
+    for (auto& kv : kvs)
+        batch.push_back(kv.first).push_back(kv.second);
+    twait [twait_description("insert_batch")] {
+        fd_->call(Json::array(pq_insert_batch, seq_, std::move(batch)), make_event(j));
+        ++seq_;
+    }
+    assert(j[0] == -pq_insert_batch && j[1] == seq);
+    e();
+}
+
 tamed void RemoteClient::insert_db(const String& key, const String& value, event<> e) {
     (void)key;
     (void)value;
@@ -124,22 +152,103 @@ tamed void RemoteClient::add_count(const String& first, const String& last,
 
 tamed void RemoteClient::scan(const String& first, const String& last,
                               event<scan_result> e) {
-    tvars { Json j; }
-    twait [twait_description("scan", first, last)] {
-        fd_->call(Json::array(pq_scan, seq_, first, last), make_event(j));
-        ++seq_;
-    }
-    e(scan_result(j && j[2].to_i() == pq_ok ? j[3] : Json::make_array()));
+    scan(first, last, last, e);
 }
 
 tamed void RemoteClient::scan(const String& first, const String& last,
                               const String& scanlast, event<scan_result> e) {
-    tvars { Json j; }
+    scan(first, last, scanlast, 0, e);
+}
+
+tamed void RemoteClient::scan_paged(const String& first, const String& last,
+                                    const String& scanlast, event<scan_result> e) {
+    tvars { scan_result res, page; }
+    // fetch the range a chunk at a time so the server never buffers it all
+    do {
+        twait { scan(res.cursor_ ? res.cursor_ : first, last, scanlast,
+                     pq_scan_max_pairs, make_event(page)); }
+        append_result(res, page);
+    } while (res.cursor_);
+    e(std::move(res));
+}
+
+tamed void RemoteClient::scan(const String& first, const String& last,
+                              const String& scanlast, size_t limit,
+                              event<scan_result> e) {
+    tvars { Json j; StringAccum sa; }
     twait [twait_description("scan", first, last)] {
-        fd_->call(Json::array(pq_scan, seq_, first, last, scanlast), make_event(j));
+        fd_->call(Json::array(pq_scan, seq_, first, last, scanlast, limit,
+                              pq_scan_compact),
+                  make_event(j));
+        ++seq_;
+    }
+    if (!j || j[2].to_i() != pq_ok)
+        e(scan_result(Json::make_array()));
+    else if (!j[4].is_s())
+        e(scan_result(expand_scan(j[3])));
+    else {
+        // resume just after the last key returned
+        sa << j[4].as_s() << '\0';
+        e(scan_result(expand_scan(j[3]), sa.take_string()));
+    }
+}
+
+// Keys are rebuilt into one shared buffer; plain replies pass through.
+Json RemoteClient::expand_scan(const Json& x) {
+    if (!x.is_a() || x.empty() || !x[0].is_i())
+        return x;
+
+    size_t total = 0;
+    for (size_t i = 0; i + 2 < x.size(); i += 3)
+        total += x[i].to_u64() + x[i + 1].as_s().length();
+    String buf = String::make_uninitialized(total);
+    char* s = const_cast<char*>(buf.data());
+
+    Json pairs = Json::make_array_reserve(2 * (x.size() / 3));
+    const char* prev = s;
+    int prevlen = 0;
+    for (size_t i = 0; i + 2 < x.size(); i += 3) {
+        int shared = std::min(int(x[i].to_u64()), prevlen);
+        const String& suffix = x[i + 1].as_s();
+        memcpy(s, prev, shared);
+        memcpy(s + shared, suffix.data(), suffix.length());
+        prev = s;
+        prevlen = shared + suffix.length();
+        pairs.push_back(buf.fast_substring(s, s + prevlen))
+            .push_back(x[i + 2]);
+        s += prevlen;
+    }
+    return pairs;
+}
+
+tamed void RemoteClient::rscan(const String& first, const String& last,
+                               size_t limit, event<rscan_result> e) {
+    tvars { Json j; rscan_result res, page; }
+    do {
+        twait [twait_description("rscan", first, last)] {
+            fd_->call(Json::array(pq_rscan, seq_, first,
+                                  res.cursor_ ? res.cursor_ : last,
+                                  limit ? limit - res.size() : 0),
+                      make_event(j));
+            ++seq_;
+        }
+        if (!j || j[2].to_i() != pq_ok)
+            page = rscan_result(Json::make_array());
+        else
+            page = rscan_result(Json(j[3]), j[4].is_s() ? j[4].as_s() : String());
+        append_result(res, page);
+    } while (res.cursor_ && (!limit || res.size() < limit));
+    e(std::move(res));
+}
+
+tamed void RemoteClient::multi(const Json& ops, event<Json> e) {
+    tvars { Json j; unsigned long seq = this->seq_; }
+    twait [twait_description("multi")] {
+        fd_->call(Json::array(pq_multi, seq_, ops), make_event(j));
         ++seq_;
     }
-    e(scan_result(j && j[2].to_i() == pq_ok ? j[3] : Json::make_array()));
+    assert(j[0] == -pq_multi && j[1] == seq);
+    e(j && j[2].to_i() == pq_ok ? j[3] : Json::make_array());
 }
 
 tamed void RemoteClient::stats(event<Json> e) {
@@ -21,7 +21,33 @@ enum {
     pq_add_join = 11,
     pq_stats = 12,
     pq_control = 13,
-    pq_noop_get = 14
+    pq_noop_get = 14,
+
+    // later additions; append new commands so deployed clients and
+    // peers keep their numbers
+
+    // like pq_scan, but newest first
+    pq_rscan = 15,
+
+    // [pq_multi, seq, [op...]], where each op is [command, args...] for
+    // pq_get, pq_insert, pq_erase, pq_count or pq_scan. The reply's value
+    // has one result per op: the value, null, the count, or a flat
+    // [key, value, ...] array; a malformed op's result is null. A scan op
+    // with a limit, [pq_scan, first, last, scanlast, limit], instead
+    // returns [[key, value, ...], cursor], where the cursor is the last
+    // key returned if the limit cut the result short and null otherwise
+    pq_multi = 16,
+
+    // [pq_notify_batch, seq, [key, value, ...]]; a null value is an erase
+    pq_notify_batch = 17,
+
+    // [pq_subscribe_batch, seq, [first, last, ...], {"subscriber": id}];
+    // the reply's value has one scan array per range
+    pq_subscribe_batch = 18,
+
+    // [pq_insert_batch, seq, [key, value, ...]]; the pairs are applied in
+    // key order, with a repeated key keeping its last value
+    pq_insert_batch = 19
 };
 
 enum {
@@ -29,4 +55,16 @@ enum {
     pq_fail = -1
 };
 
+// the most pairs a pq_scan with a limit, or any pq_rscan, returns at
+// once; a cut-short reply carries a cursor to resume from
+enum { pq_scan_max_pairs = 4096 };
+
+// flags, the optional element after pq_scan's limit; subscribe asks for
+// compact replies with {"compact": true}
+enum {
+    // reply pairs as [shared, suffix, value] triples, where the key is
+    // the first `shared` bytes of the previous key followed by suffix
+    pq_scan_compact = 1
+};
+
 #endif
@@ -5,6 +5,7 @@
 #include "pqserver.hh"
 #include "pqjoin.hh"
 #include "pqinterconnect.hh"
+#include "pqrpc.hh"
 #include "json.hh"
 #include "error.hh"
 #include <sys/resource.h>
@@ -32,11 +33,29 @@ void Table::iterator::fix() {
     }
 }
 
+void Table::iterator::fix_prev() {
+    // step back over subtable boundaries; caller ensures a previous datum
+    while (1) {
+        if (it_ == table_->store_.begin()) {
+            assert(table_->parent_ && (!top_ || top_ != table_));
+            it_ = table_->parent_->store_.iterator_to(*table_);
+            table_ = table_->parent_;
+        } else {
+            --it_;
+            if (!it_->is_table())
+                return;
+            table_ = &it_->table();
+            it_ = table_->store_.end();
+        }
+    }
+}
+
 Table::Table(Str name, Table* parent, Server* server)
     : Datum(name, String::make_stable(Datum::table_marker)),
-      triecut_(0), njoins_(0), server_{server}, parent_{parent}, 
+      triecut_(0), source_version_(0), njoins_(0), ndata_(0), server_{server}, parent_{parent}, 
       ninsert_(0), nmodify_(0), nmodify_nohint_(0), nerase_(0), nvalidate_(0) {
 
+    store_set_key_prefix(store_, name);
     memset(&nsubtables_with_ranges_, 0, sizeof(nsubtables_with_ranges_));
     memset(&nevict_sink_, 0, sizeof(nevict_sink_));
     memset(&nevict_remote_, 0, sizeof(nevict_remote_));
@@ -122,12 +141,29 @@ size_t Table::count(Str key) const {
     return 0;
 }
 
-size_t Table::size() const {
-    size_t x = store_.size();
-    if (triecut_)
-        for (auto& d : store_)
-            if (d.is_table())
-                x += static_cast<const Table&>(d).size();
+size_t Table::count(Str first, Str last) const {
+    if (!triecut_)
+        return store_distance(store_, store_.lower_bound(first, KeyCompare()),
+                              store_.lower_bound(last, KeyCompare()));
+
+    // entries at this level are subtables plus the occasional key
+    // shorter than the triecut, so walk them and count subtables whole
+    // unless a range endpoint falls inside. This is linear in the number
+    // of subtables the range covers; only the boundary subtables pay for
+    // store_distance, which is O(log n) with the B+tree store and linear
+    // in the counted keys with the red-black tree.
+    size_t x = 0;
+    for (auto it = store_.lower_bound(first.prefix(triecut_), KeyCompare());
+         it != store_.end() && it->key() < last; ++it)
+        if (!it->is_table())
+            x += first <= it->key();
+        else {
+            const Table& t = it->table();
+            if (first <= t.name() && last.prefix(triecut_) != t.name())
+                x += t.size();
+            else
+                x += t.count(first, last);
+        }
     return x;
 }
 
@@ -142,6 +178,7 @@ void Table::add_source(SourceRange* r) {
 	    return;
 	}
     source_ranges_.insert(*r);
+    ++source_version_;
 }
 
 void Table::remove_source(Str first, Str last, Sink* sink, Str context) {
@@ -221,6 +258,7 @@ void Table::insert(Str key, String value) {
 	d = new Datum(key, value);
         value = String();
 	store_.insert_commit(*d, cd);
+        adjust_size(1);
     } else {
 	d = p.first.operator->();
         d->value().swap(value);
@@ -230,6 +268,165 @@ void Table::insert(Str key, String value) {
     ++ninsert_;
 }
 
+static const size_t max_deferred = 1 << 16;
+
+// Inserts pairs sorted by key, all owned here and all in this table. The
+// sources containing a key also contain every later key up to the next
+// source boundary, so they are looked up once per such run rather than
+// once per key. Sink modifications are deferred and then applied in sink
+// key order, which keeps each sink's hint useful; a key with a source
+// that cannot defer is notified immediately, as Table::insert would.
+void Table::insert_batch(std::pair<String, String>* first,
+                         std::pair<String, String>* last) {
+    std::vector<SourceRange*> sources;
+    std::vector<SourceRange::deferred> pending;
+    StringAccum keys;
+    Datum* hint = nullptr;
+    uint64_t version = 0;
+    Str bound;
+    bool bounded = false, found = false;
+
+    for (; first != last; ++first) {
+        // only the last value of a repeated key matters
+        if (first + 1 != last && first[1].first == first->first)
+            continue;
+
+        Str key(first->first);
+        assert(!triecut_ || key.length() < triecut_);
+        store_type::insert_commit_data cd;
+        auto p = insert_check(key, hint, cd);
+        Datum* d;
+        String value;
+        value.swap(first->second);
+        if (p.second) {
+            d = new Datum(key, value);
+            value = String();
+            store_.insert_commit(*d, cd);
+            adjust_size(1);
+        } else {
+            d = p.first.operator->();
+            d->value().swap(value);
+        }
+        d->ref();
+        if (hint)
+            hint->deref();
+        hint = d;
+        int notifier = p.second ? SourceRange::notify_insert : SourceRange::notify_update;
+
+        if (!found || source_version() != version || (bounded && !(key < bound))) {
+            version = source_version();
+            bounded = collect_sources(key, sources, bound);
+            found = true;
+        }
+        bool defer = true;
+        for (auto source : sources)
+            defer = defer && source->deferrable();
+        if (!defer && !pending.empty()) {
+            apply_deferred(pending, keys);
+            if (source_version() != version) {
+                version = source_version();
+                bounded = collect_sources(key, sources, bound);
+            }
+        }
+        for (auto source : sources)
+            if (source->check_match(key)) {
+                if (defer)
+                    source->defer(d, value, notifier, pending, keys);
+                else
+                    source->notify(d, value, notifier);
+            }
+        if (pending.size() >= max_deferred)
+            apply_deferred(pending, keys);
+        ++ninsert_;
+    }
+
+    apply_deferred(pending, keys);
+    if (hint)
+        hint->deref();
+}
+
+static bool deferred_sink_less(const SourceRange::deferred* a,
+                               const SourceRange::deferred* b) {
+    return a->sink < b->sink;
+}
+
+// Applies deferred modifications sink by sink, each sink's in key order;
+// a sink's hint then usually points just before its next key.
+void Table::apply_deferred(std::vector<SourceRange::deferred>& pending,
+                           StringAccum& keys) {
+    auto sink_key = [&](const SourceRange::deferred* x) {
+        return Str(keys.data() + x->sink_key_pos, x->sink_key_len);
+    };
+    auto key_less = [&](const SourceRange::deferred* a,
+                        const SourceRange::deferred* b) {
+        return sink_key(a) < sink_key(b);
+    };
+
+    std::vector<SourceRange::deferred*> order;
+    order.reserve(pending.size());
+    for (auto& x : pending)
+        order.push_back(&x);
+    std::stable_sort(order.begin(), order.end(), deferred_sink_less);
+    for (auto it = order.begin(); it != order.end(); ) {
+        auto jt = it + 1;
+        bool sorted = true;
+        for (; jt != order.end() && (*jt)->sink == (*it)->sink; ++jt)
+            sorted = sorted && !key_less(*jt, jt[-1]);
+        if (!sorted)
+            std::stable_sort(it, jt, key_less);
+        it = jt;
+    }
+
+    for (auto it = order.begin(); it != order.end(); ++it) {
+        SourceRange::deferred& x = **it;
+        // a modification can cascade into killing sources here
+        if (!x.source->dead() && x.sink->valid() && x.src->valid()
+            && !x.sink->invalidated(sink_key(&x)))
+            x.source->apply(x, keys);
+        x.source->deref();
+        x.sink->deref();
+        x.src->deref();
+    }
+    pending.clear();
+    keys.clear();
+}
+
+bool Table::has_remote(Str key) {
+    for (Table* t = this; t; t = t->parent_) {
+        if (!t->remote_ranges_.empty()
+            && t->remote_ranges_.begin_contains(key) != t->remote_ranges_.end())
+            return true;
+        if (!t->parent_ || !t->parent_->triecut_)
+            break;
+    }
+    return false;
+}
+
+// Sets sources to those containing key, as Table::notify would find them.
+// Returns false if every later key has the same sources; otherwise sets
+// bound to the first key that might not.
+bool Table::collect_sources(Str key, std::vector<SourceRange*>& sources, Str& bound) {
+    bool bounded = false;
+    sources.clear();
+    for (Table* t = this; t; t = t->parent_) {
+        for (auto it = t->source_ranges_.begin_contains(key);
+             it != t->source_ranges_.end(); ++it) {
+            sources.push_back(it.operator->());
+            if (!bounded || it->iend() < bound)
+                bound = it->iend();
+            bounded = true;
+        }
+        if (SourceRange* next = t->source_ranges_.first_begin_after(key)) {
+            if (!bounded || next->ibegin() < bound)
+                bound = next->ibegin();
+            bounded = true;
+        }
+        if (!t->parent_ || !t->parent_->triecut_)
+            break;
+    }
+    return bounded;
+}
+
 tamed void Table::erase(Str key, tamer::event<> done) {
     tvars {
         int32_t owner = this->server_->owner_for(key);
@@ -268,12 +465,19 @@ std::pair<ServerStore::iterator, bool> Table::prepare_modify(Str key, const Sink
                                                              ServerStore::insert_commit_data& cd) {
     assert(name() && sink);
     assert(!triecut_ || key.length() < triecut_);
-    std::pair<ServerStore::iterator, bool> p;
     Datum* hint = sink->hint();
-    if (!hint || !hint->valid()) {
+    if (!hint || !hint->valid())
         ++nmodify_nohint_;
+    return insert_check(key, hint, cd);
+}
+
+// like store_.insert_check, but starts just after hint when there is one
+std::pair<ServerStore::iterator, bool> Table::insert_check(Str key, Datum* hint,
+                                                           ServerStore::insert_commit_data& cd) {
+    std::pair<ServerStore::iterator, bool> p;
+    if (!hint || !hint->valid())
         p = store_.insert_check(key, KeyCompare(), cd);
-    } else {
+    else {
         p.first = store_.iterator_to(*hint);
         if (hint->key() == key)
             p.second = false;
@@ -297,11 +501,13 @@ void Table::finish_modify(std::pair<ServerStore::iterator, bool> p,
             d = new Datum(key, sink);
             sink->add_datum(d);
             p.first = store_.insert_commit(*d, cd);
+            adjust_size(1);
             n = SourceRange::notify_insert;
         }
     } else if (is_erase_marker(value)) {
         if (!p.second) {
             p.first = store_.erase(p.first);
+            adjust_size(-1);
             n = SourceRange::notify_erase;
         } else
             goto done;
@@ -355,6 +561,7 @@ std::pair<bool, Table::iterator> Table::validate_local(Str first, Str last,
             // single range covers lookup?
             if (sr->ibegin() <= first && last <= sr->iend()) {
                 if (sr->valid(now)) {
+                    sr->count_read();
                     server_->lru_touch(sr);
                     return std::make_pair(true, iterator(this, kit, this));
                 }
@@ -533,8 +740,8 @@ std::pair<bool, Table::iterator> Table::validate_remote(Str first, Str last,
             for (Table* t = rrt->parent_; t; t = t->parent_)
                 --t->nsubtables_with_ranges_.remote;
 
-            server_->interconnect(owner)->unsubscribe(rr->ibegin(), rr->iend(),
-                                                      server_->me(), tamer::event<>());
+            server_->interconnect(rr->owner())->unsubscribe(rr->ibegin(), rr->iend(),
+                                                            server_->me(), tamer::event<>());
 
             rrt->fetch_remote(rr->ibegin(), rr->iend(), owner, gr.make_event());
             fetching = true;
@@ -580,14 +787,18 @@ void Table::notify(Datum* d, const String& old_value, SourceRange::notify_type n
 }
 
 void Table::invalidate_dependents(Str key) {
+    uint8_t next_key[key_capacity + 1];
+    memcpy(next_key, key.data(), key.length());
+    next_key[key.length()] = 0;
+    Str last(next_key, key.length() + 1);
+
     Table* t = &table_for(key);
  retry:
     for (auto it = t->source_ranges_.begin_contains(key);
          it != t->source_ranges_.end(); ) {
-        // simple, but obviously we could do better
         SourceRange* source = it.operator->();
         ++it;
-        source->invalidate();
+        source->invalidate(key, last);
     }
     if ((t = t->parent_) && t->triecut_)
         goto retry;
@@ -596,10 +807,10 @@ void Table::invalidate_dependents(Str key) {
 inline void Table::invalidate_dependents_local(Str first, Str last) {
     for (auto it = source_ranges_.begin_overlaps(first, last);
          it != source_ranges_.end(); ) {
-        // simple, but obviously we could do better
         SourceRange* source = it.operator->();
         ++it;
-        source->invalidate();
+        source->invalidate(first < source->ibegin() ? source->ibegin() : first,
+                           source->iend() < last ? source->iend() : last);
     }
 }
 
@@ -685,33 +896,23 @@ void Table::evict_persisted(PersistedRange* pr) {
     }
 }
 
-tamed void Table::fetch_remote(String first, String last, int32_t owner,
-                               tamer::event<> done) {
-    tvars {
-        RemoteRange* rr = new RemoteRange(this, first, last, owner);
-        Interconnect::scan_result res;
-    }
-
+void Table::fetch_remote(Str first, Str last, int32_t owner,
+                         tamer::event<> done) {
+    // with relaying, subscribe through our parent in the fan-out tree
+    RemoteRange* rr = new RemoteRange(this, first, last,
+                                      server_->upstream_for(owner));
     rr->add_waiting(done);
+    // replicas stay put however often they are fetched again
+    if (server_->is_replicated(first))
+        rr->pin();
 
     for (Table* t = parent_; t; t = t->parent_)
         ++t->nsubtables_with_ranges_.remote;
     remote_ranges_.insert(*rr);
 
     // std::cerr << "fetching remote data: " << rr->interval() << std::endl;
-    twait {
-        server_->interconnect(owner)->subscribe(first, last, server_->me(),
-                                                make_event(res));
-    }
-
-    // std::cerr << "remote data fetch: " << rr->interval() << " returned "
-    //          << res.size() << " results" << std::endl;
-
-    for (auto it = res.begin(); it != res.end(); ++it)
-        server_->make_table_for(it->key()).insert(it->key(), it->value());
-
-    server_->lru_touch(rr);
-    rr->notify_waiting();
+    // later validators of the range wait on rr while it is pending
+    server_->queue_remote_fetch(rr);
 }
 
 void Table::evict_remote(RemoteRange* rr) {
@@ -777,6 +978,10 @@ void Table::invalidate_remote(Str first, Str last) {
         while(it != itend)
             it = erase_invalid(it);
 
+        // a replica is subscribed to again right away, not on the next read
+        if (rr->pinned())
+            rrt->fetch_remote(rr->ibegin(), rr->iend(),
+                              server_->owner_for(rr->ibegin()), tamer::event<>());
         delete rr;
     }
 }
@@ -812,7 +1017,10 @@ void Table::remove_subscription(Str first, Str last, int32_t peer) {
     assert(peer != server_->me());
 
     //std::cerr << "unsubscribing " << peer << " from range [" << first << ", " << last << ")" << std::endl;
-    remove_source(first, last, server_->remote_sink(peer), Str());
+    RemoteSink* sink = server_->remote_sink(peer);
+    remove_source(first, last, sink, Str());
+    // nothing queued for the range may trail the unsubscribe
+    sink->conn()->flush_notify();
 }
 
 
@@ -820,10 +1028,12 @@ Server::Server()
     : persistent_store_(nullptr), writethrough_(false),
       supertable_(Str(), nullptr, this),
       last_validate_at_(0), validate_time_(0), insert_time_(0), evict_time_(0),
-      part_(nullptr), me_(-1),
+      refresh_time_(0),
+      part_(nullptr), me_(-1), relay_fanout_(0),
       prob_rng_(0,1), evict_lo_(0), evict_hi_(0), evict_scale_(0),
       evict_tomb_(true), evict_rand_(false), evict_multi_(true), 
-      evict_multi_perm_({0, 1, 2, 3}) {
+      evict_multi_perm_({0, 1, 2, 3}),
+      refresh_ahead_(0), refresh_budget_(0), nrefresh_(0) {
 
     gettimeofday(&start_tv_, NULL);
     gen_.seed(112181);
@@ -857,6 +1067,45 @@ tamed void Server::insert(Str key, const String& value, tamer::event<> done) {
     done();
 }
 
+static bool key_less(const std::pair<String, String>& a,
+                     const std::pair<String, String>& b) {
+    return a.first < b.first;
+}
+
+tamed void Server::insert_batch(std::vector<std::pair<String, String> > kvs,
+                                tamer::event<> done) {
+    tvars {
+        struct timeval tv[2];
+        size_t i = 0, j;
+        Table* t;
+        tamer::gather_rendezvous gr;
+    }
+
+    gettimeofday(&tv[0], NULL);
+    // stable, so a repeated key ends up with its last value
+    std::stable_sort(kvs.begin(), kvs.end(), key_less);
+    while (i != kvs.size()) {
+        t = &make_table_for(kvs[i].first);
+        if (!is_local_write(kvs[i].first)) {
+            t->insert(kvs[i].first, kvs[i].second, gr.make_event());
+            ++i;
+            continue;
+        }
+        for (j = i + 1; j != kvs.size(); ++j)
+            if (&make_table_for(kvs[j].first) != t
+                || !is_local_write(kvs[j].first))
+                break;
+        t->insert_batch(kvs.data() + i, kvs.data() + j);
+        i = j;
+    }
+    twait(gr);
+    gettimeofday(&tv[1], NULL);
+    insert_time_ += to_real(tv[1] - tv[0]);
+
+    maybe_evict();
+    done();
+}
+
 tamed void Server::erase(Str key, tamer::event<> done) {
     twait { table_for(key).erase(key, done); }
 }
@@ -875,6 +1124,7 @@ tamed void Server::validate(Str key, tamer::event<Table::iterator> done) {
         twait(gr);
         gettimeofday(&tv[0], NULL);
         it = t->validate(key, next_validate_at(), log, gr);
+        flush_remote_fetches();
         gettimeofday(&tv[1], NULL);
         difft += tv2us(tv[1] - tv[0]);
         assert(gr.has_waiting() == !it.first);
@@ -903,6 +1153,7 @@ tamed void Server::validate(Str first, Str last, tamer::event<Table::iterator> d
         twait(gr);
         gettimeofday(&tv[0], NULL);
         it = t->validate(first, last, next_validate_at(), log, gr);
+        flush_remote_fetches();
         gettimeofday(&tv[1], NULL);
         difft += tv2us(tv[1] - tv[0]);
         assert(gr.has_waiting() == !it.first);
@@ -916,6 +1167,155 @@ tamed void Server::validate(Str first, Str last, tamer::event<Table::iterator> d
     done(it.second);
 }
 
+void Server::flush_remote_fetches() {
+    if (remote_fetches_.empty())
+        return;
+
+    std::stable_sort(remote_fetches_.begin(), remote_fetches_.end(),
+                     [](RemoteRange* a, RemoteRange* b) {
+                         return a->owner() < b->owner();
+                     });
+    auto it = remote_fetches_.begin();
+    while (it != remote_fetches_.end()) {
+        auto next = it + 1;
+        while (next != remote_fetches_.end() && (*next)->owner() == (*it)->owner())
+            ++next;
+        fetch_remote((*it)->owner(), std::vector<RemoteRange*>(it, next));
+        it = next;
+    }
+    remote_fetches_.clear();
+}
+
+tamed void Server::flush_remote_fetches_asap() {
+    twait { tamer::at_asap(make_event()); }
+    flush_remote_fetches();
+}
+
+// Subscribes to, and pins, this server's copy of every replicated range.
+// The owners push writes to the copies, so validations of those ranges
+// stay local. Backing servers do not hold replicas.
+void Server::replicate() {
+    if (!part_ || part_->is_backend(me_))
+        return;
+
+    std::vector<keyrange> parts;
+    for (auto& prefix : part_->replicated()) {
+        mandatory_assert(prefix && (unsigned char) prefix.back() != 255);
+        String last(prefix);
+        ++last.mutable_data()[last.length() - 1];
+
+        parts.clear();
+        part_->analyze(prefix, last, 0, parts);
+        parts.push_back(keyrange(last, -1));
+        for (auto k = parts.begin(); k + 1 != parts.end(); ++k)
+            if (is_remote(k->owner))
+                make_table_for(k[0].key, k[1].key)
+                    .fetch_remote(k[0].key, k[1].key, k->owner, tamer::event<>());
+    }
+    flush_remote_fetches();
+}
+
+tamed void Server::fetch_remote(int32_t peer, std::vector<RemoteRange*> rrs) {
+    tvars {
+        std::vector<String> bounds;
+        std::vector<Interconnect::scan_result> res;
+        Interconnect::scan_result one;
+    }
+
+    if (rrs.size() == 1)
+        twait {
+            interconnect(peer)->subscribe(rrs[0]->ibegin(), rrs[0]->iend(),
+                                          me_, make_event(one));
+        }
+    else {
+        for (auto rr : rrs) {
+            bounds.push_back(rr->ibegin());
+            bounds.push_back(rr->iend());
+        }
+        twait { interconnect(peer)->subscribe(bounds, me_, make_event(res)); }
+    }
+
+    for (size_t i = 0; i < rrs.size(); ++i) {
+        Interconnect::scan_result& r = rrs.size() == 1 ? one : res[i];
+        for (auto it = r.begin(); it != r.end(); ++it)
+            make_table_for(it->key()).insert(it->key(), it->value());
+
+        lru_touch(rrs[i]);
+        rrs[i]->notify_waiting();
+    }
+}
+
+// Runs a batch of operations in order; see pq_multi in pqrpc.hh.
+tamed void Server::multi(Json ops, tamer::event<Json> done) {
+    tvars {
+        Json res = Json::make_array_reserve(ops.size()), op, aj;
+        Table::iterator it;
+        String first, last, scanlast;
+        size_t i, n, limit;
+    }
+
+    for (i = 0; i != ops.size(); ++i) {
+        op = ops.get(i);
+        if (!op.is_a() || !op[1].is_s() || !table_name(op[1].as_s())
+            || (op[0].to_i() >= pq_count
+                && !(op[2].is_s() && table_name(op[1].as_s(), op[2].as_s())))) {
+            res.push_back(Json());
+            continue;
+        }
+
+        first = op[1].as_s();
+        switch (op[0].to_i()) {
+        case pq_get:
+            twait { validate(first, make_event(it)); }
+            if (it != it.table_end() && it->key() == first)
+                res.push_back(it->value());
+            else
+                res.push_back(String());
+            break;
+        case pq_insert:
+            if (op[2].is_s())
+                twait { insert(first, op[2].as_s(), make_event()); }
+            res.push_back(Json());
+            break;
+        case pq_erase:
+            twait { erase(first, make_event()); }
+            res.push_back(Json());
+            break;
+        case pq_count:
+        case pq_scan:
+            last = op[2].as_s();
+            scanlast = op[3].is_s() ? op[3].as_s() : last;
+            twait { validate(first, last, make_event(it)); }
+            if (op[0].to_i() == pq_count)
+                res.push_back(table_for(first, last).count(first, scanlast));
+            else {
+                limit = std::min(op[4].to_u64(), uint64_t(pq_scan_max_pairs));
+                auto itend = it.table_end();
+                aj = Json::make_array();
+                for (n = 0; it != itend && it->key() < scanlast; ++n, ++it) {
+                    if (limit && n == limit)
+                        break;
+                    aj.push_back(it->key()).push_back(it->value());
+                }
+                if (limit) {
+                    // [pairs, cursor]; the cursor is the last key
+                    // returned, or null if the range is done
+                    Json cursor;
+                    if (it != itend && it->key() < scanlast)
+                        cursor = aj[aj.size() - 2];
+                    aj = Json::array(std::move(aj), std::move(cursor));
+                }
+                res.push_back(std::move(aj));
+            }
+            break;
+        default:
+            res.push_back(Json());
+            break;
+        }
+    }
+    done(std::move(res));
+}
+
 tamed void Server::periodic_eviction() {
     tvars {
         uint64_t start;
@@ -937,6 +1337,92 @@ tamed void Server::periodic_eviction() {
     }
 }
 
+// Re-validates recently read sink ranges whose results expire by horizon,
+// most recently read first, until budget microseconds have been spent.
+// Returns the number of ranges refreshed.
+uint32_t Server::refresh_expiring(uint64_t horizon, uint64_t budget,
+                                  tamer::gather_rendezvous& gr) {
+    struct timeval tv[2];
+    gettimeofday(&tv[0], NULL);
+    uint64_t start = tv2us(tv[0]);
+
+    // refreshing can reorder the LRU, so pick the ranges first
+    lru_type& lru = lru_[evict_multi_ && !evict_rand_
+                         ? evict_multi_perm_[Evictable::pri_sink]
+                         : Evictable::pri_none];
+    std::vector<SinkRange*> due;
+    uint32_t n = 0;
+    for (auto it = lru.rbegin(); it != lru.rend(); ++it) {
+        if (it->priority() == Evictable::pri_sink) {
+            SinkRange* sr = static_cast<SinkRange*>(&*it);
+            if (sr->refresh_due(horizon))
+                due.push_back(sr);
+        }
+        if (++n % 256 == 0 && tstamp() - start >= budget)
+            break;
+    }
+
+    n = 0;
+    for (auto sr : due) {
+        if (tstamp() - start >= budget)
+            break;
+        sr->refresh(horizon, *this, next_validate_at(), gr);
+        ++n;
+    }
+
+    nrefresh_ += n;
+    gettimeofday(&tv[1], NULL);
+    refresh_time_ += to_real(tv[1] - tv[0]);
+    return n;
+}
+
+// Like validate(), loops until the sink is complete, sending the remote
+// fetches each pass queues.
+tamed void Server::refresh_sink(Sink* sink, tamer::event<> done) {
+    tvars {
+        uint32_t log = 0;
+        tamer::gather_rendezvous gr;
+    }
+
+    sink->ref();
+    do {
+        twait(gr);
+        if (!sink->valid())
+            break;
+        sink->validate(sink->ibegin(), sink->iend(), *this,
+                       next_validate_at(), log, gr);
+        flush_remote_fetches();
+    } while (gr.has_waiting());
+    sink->deref();
+    done();
+}
+
+tamed void Server::periodic_refresh() {
+    tvars {
+        tamer::gather_rendezvous gr;
+    }
+
+    while (true) {
+        refresh_expiring(tstamp() + refresh_ahead_, refresh_budget_, gr);
+        twait(gr);
+
+        // check several times per window so nothing slips past it
+        twait volatile {
+            tamer::at_delay_usec(std::max(refresh_ahead_ / 4, uint64_t(1000)),
+                                 make_event());
+        }
+    }
+}
+
+void Server::set_refresh_details(uint64_t ahead_usec, uint64_t budget_usec) {
+    mandatory_assert(!ahead_usec || budget_usec, "Refresh-ahead needs a CPU budget.");
+    bool start = ahead_usec && !refresh_ahead_;
+    refresh_ahead_ = ahead_usec;
+    refresh_budget_ = budget_usec;
+    if (start)
+        periodic_refresh();
+}
+
 tamed void Server::set_eviction_details(uint64_t low_mb, uint64_t high_mb,
                                         bool etomb, bool erand, bool emulti, bool epref_sink, 
                                         bool einline, bool eperiodic) {
@@ -1063,7 +1549,10 @@ Json Server::stats() const {
         .set("server_wall_time_insert", insert_time_)
         .set("server_wall_time_validate", validate_time_)
         .set("server_wall_time_evict", evict_time_)
-        .set("server_wall_time_other", wall_time - insert_time_ - validate_time_ - evict_time_);
+        .set("server_wall_time_refresh", refresh_time_)
+        .set("server_wall_time_other", wall_time - insert_time_ - validate_time_
+                                       - evict_time_ - refresh_time_)
+        .set("server_nrefresh", nrefresh_);
 
     if (enable_validation_logging) {
         uint32_t nclear = 0, ncompute = 0, nupdate = 0,
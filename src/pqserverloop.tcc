@@ -57,19 +57,171 @@ blocked_locations_shrink(std::vector<std::string>::iterator first,
     return out;
 }
 
+inline bool is_flat_command(int32_t command) {
+    return command == pq_get || command == pq_insert || command == pq_erase
+        || command == pq_count || command == pq_scan;
+}
+
+inline int shared_prefix_length(Str a, Str b) {
+    int n = std::min(a.length(), b.length()), i = 0;
+    while (i != n && a[i] == b[i])
+        ++i;
+    return i;
+}
+
+// appends one scan reply pair to aj; see pq_scan_compact
+inline void push_scan_pair(Json& aj, Str& prevkey, const pq::Datum& d,
+                           bool compact) {
+    Str key = d.key();
+    if (compact) {
+        int shared = shared_prefix_length(prevkey, key);
+        aj.push_back(shared).push_back(Str(key.begin() + shared, key.end()))
+            .push_back(d.value());
+    } else
+        aj.push_back(key).push_back(d.value());
+    prevkey = key;
+}
+
+template <typename T>
+inline void write_flat_value(msgpack_fd*, msgpack::unparser<StringAccum>& up,
+                             const T& value) {
+    up << value;
+}
+
+inline void write_flat_value(msgpack_fd* mpfd, msgpack::unparser<StringAccum>&,
+                             const String& value) {
+    mpfd->write_string(value);
+}
+
+template <typename T>
+void write_flat_reply(msgpack_fd* mpfd, const msgpack::flat_array& req,
+                      int status, const T& value) {
+    StringAccum& sa = mpfd->begin_write();
+    int old_len = sa.length();
+    msgpack::unparser<StringAccum> up(sa);
+    up << msgpack::array(4) << -int(req.as_i(0)) << req.as_i(1) << status;
+    write_flat_value(mpfd, up, value);
+    mpfd->end_write(sa.length() - old_len);
+}
+
+void write_flat_scan_reply(msgpack_fd* mpfd, const msgpack::flat_array& req,
+                           pq::Table::iterator it, size_t limit) {
+    Str scanlast = req.is_s(4) ? req.as_s(4) : req.as_s(3);
+    bool compact = req.to_u64(6) & pq_scan_compact;
+    auto itend = it.table_end();
+    StringAccum& sa = mpfd->begin_write();
+    int old_len = sa.length();
+    msgpack::unparser<StringAccum> up(sa);
+    up << msgpack::array(5) << -int(pq_scan) << req.as_i(1) << int(pq_ok);
+
+    // the pair count is patched in once known
+    int count_pos = sa.length();
+    sa.append(char(msgpack::format::farray32));
+    sa.extend(4);
+    uint32_t n = 0;
+    bool more = false;
+    Str lastkey;
+    while (it != itend && it->key() < scanlast) {
+        if (limit && n == limit) {
+            more = true;
+            break;
+        }
+        Str key = it->key();
+        if (compact) {
+            int shared = shared_prefix_length(lastkey, key);
+            up << shared << Str(key.begin() + shared, key.end());
+        } else
+            up << key;
+        mpfd->write_string(it->value());
+        lastkey = key;
+        ++n;
+        ++it;
+    }
+    write_in_net_order<uint32_t>(sa.data() + count_pos + 1,
+                                 (compact ? 3 : 2) * n);
+    if (more)
+        up << lastkey;
+    else
+        up.null();
+    mpfd->end_write(sa.length() - old_len);
+}
+
+// [key, value, ...] to pairs, skipping malformed or tableless entries
+static std::vector<std::pair<String, String> > batch_pairs(const Json& batch) {
+    std::vector<std::pair<String, String> > kvs;
+    kvs.reserve(batch.size() / 2);
+    for (size_t i = 0; i + 1 < batch.size(); i += 2)
+        if (batch[i].is_s() && batch[i + 1].is_s()
+            && pq::table_name(batch[i].as_s()))
+            kvs.emplace_back(batch[i].as_s(), batch[i + 1].as_s());
+    return kvs;
+}
+
 tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
                                 tamer::event<bool> done) {
     tvars {
-        Json j, rj = Json::array(0, 0, 0), aj = Json::make_array();
+        Json j, rj, aj;
+        msgpack::flat_array fr;
         int32_t command;
         String key, first, last, scanlast;
         pq::Table* t;
         pq::Table::iterator it;
         size_t count;
         int32_t peer = -1;
+        bool compact;
     }
 
-    twait { mpfd->read_request(make_event(j)); }
+    // common requests that arrive as flat arrays are decoded in place and
+    // answered without building Json
+    if (!mpfd->read_flat_request(fr))
+        twait { mpfd->read_request(make_event(j)); }
+    else if (!is_flat_command(fr.as_i(0)))
+        j = fr.to_json();
+    else {
+        done(true);
+        assert(ready_);
+        command = fr.as_i(0);
+        if (!(fr.is_s(2) && pq::table_name(fr.as_s(2)))
+            || (command == pq_insert && !fr.is_s(3))
+            || (command >= pq_count
+                && !(fr.is_s(3) && pq::table_name(fr.as_s(2), fr.as_s(3))))) {
+            write_flat_reply(mpfd, fr, pq_fail, Json::null);
+            return;
+        }
+
+        switch (command) {
+        case pq_get:
+            twait { server.validate(fr.as_s(2), make_event(it)); }
+            if (it != it.table_end() && it->key() == fr.as_s(2))
+                write_flat_reply(mpfd, fr, pq_ok, it->value());
+            else
+                write_flat_reply(mpfd, fr, pq_ok, Str());
+            break;
+        case pq_insert:
+            twait { server.insert(fr.as_s(2), fr.to_s(3), make_event()); }
+            write_flat_reply(mpfd, fr, pq_ok, Json::null);
+            ++diff_.ninsert;
+            break;
+        case pq_erase:
+            twait { server.erase(fr.as_s(2), make_event()); }
+            write_flat_reply(mpfd, fr, pq_ok, Json::null);
+            break;
+        case pq_count:
+            twait { server.validate(fr.as_s(2), fr.as_s(3), make_event(it)); }
+            count = server.table_for(fr.as_s(2), fr.as_s(3))
+                .count(fr.as_s(2), fr.is_s(4) ? fr.as_s(4) : fr.as_s(3));
+            write_flat_reply(mpfd, fr, pq_ok, count);
+            ++diff_.ncount;
+            break;
+        case pq_scan:
+            count = std::min(fr.to_u64(5), uint64_t(pq_scan_max_pairs));
+            twait { server.validate(fr.as_s(2), fr.as_s(3), make_event(it)); }
+            write_flat_scan_reply(mpfd, fr, it, count);
+            ++diff_.nscan;
+            break;
+        }
+        return;
+    }
 
     if (!j || !j.is_a() || j.size() < 2 || !j[0].is_i()) {
         std::cerr << "bad rpc: " << j << std::endl;
@@ -83,15 +235,20 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
     command = j[0].as_i();
     assert(ready_ || command == pq_control);
 
+    rj = Json::array(0, 0, 0);
+    aj = Json::make_array();
+
     rj[0] = -command;
     rj[1] = j[1];
     rj[2] = pq_fail;
     rj[3] = Json();
 
-    if (command >= pq_get && command <= pq_add_join
+    if (((command >= pq_get && command <= pq_add_join)
+         || command == pq_rscan)
         && !(j[2].is_s() && pq::table_name(j[2].as_s())))
         goto finish;
-    if (command >= pq_count && command <= pq_add_join
+    if (((command >= pq_count && command <= pq_add_join)
+         || command == pq_rscan)
         && !(j[3].is_s() && pq::table_name(j[2].as_s(), j[3].as_s())))
         goto finish;
 
@@ -133,7 +290,7 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
         first = j[2].as_s(), last = j[3].as_s();
         scanlast = (j[4] && j[4].is_s()) ? j[4].as_s() : last;
         twait { server.validate(first, last, make_event(it)); }
-        rj[3] = std::distance(it, server.table_for(first, last).lower_bound(scanlast));
+        rj[3] = server.table_for(first, last).count(first, scanlast);
         ++diff_.ncount;
         break;
     case pq_unsubscribe:
@@ -156,12 +313,19 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
             break;
         }
         first = j[2].as_s(), last = j[3].as_s(), scanlast = last;
-        assert(part_ && part_->owner(first) == me_->seqid());
+        // a non-owner can accept subscriptions when relaying: validate
+        // pulls the range from upstream and the subscription forwards it
+        assert(server.is_owned_public(server.owner_for(first))
+               || server.relay_fanout());
+        count = 0;
+        compact = j[4]["compact"].to_b();
         ++diff_.nsubscribe;
         goto do_scan;
     case pq_scan: {
         first = j[2].as_s(), last = j[3].as_s();
         scanlast = (j[4] && j[4].is_s()) ? j[4].as_s() : last;
+        count = std::min(j[5].to_u64(), uint64_t(pq_scan_max_pairs));
+        compact = j[6].to_u64() & pq_scan_compact;
 
         do_scan:
         rj[2] = pq_ok;
@@ -172,9 +336,71 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
         auto itend = it.table_end();
         assert(!aj.shared());
         aj.clear();
-        while (it != itend && it->key() < scanlast) {
-            aj.push_back(it->key()).push_back(it->value());
-            ++it;
+        Str prevkey;
+        for (size_t n = 0; it != itend && it->key() < scanlast; ++n, ++it) {
+            if (count && n == count) {
+                // more remain: reply with the last key as a cursor
+                rj[4] = prevkey;
+                break;
+            }
+            push_scan_pair(aj, prevkey, *it, compact);
+        }
+        rj[3] = aj;
+        ++diff_.nscan;
+        break;
+    }
+    case pq_subscribe_batch:
+        if (j[3] && j[3].is_o() && j[3]["subscriber"].is_i())
+            peer = j[3]["subscriber"].as_i();
+        if (unlikely(peer < 0 || !j[2].is_a())) {
+            rj[2] = pq_fail;
+            break;
+        }
+        compact = j[3]["compact"].to_b();
+        rj[2] = pq_ok;
+        rj[3] = Json::make_array_reserve(j[2].size() / 2);
+        for (count = 0; count + 1 < j[2].size(); count += 2) {
+            first = j[2][count].to_s(), last = j[2][count + 1].to_s();
+            if (!pq::table_name(first, last)) {
+                rj[3].push_back(Json::make_array());
+                continue;
+            }
+            assert(server.is_owned_public(server.owner_for(first))
+                   || server.relay_fanout());
+            twait { server.validate(first, last, make_event(it)); }
+            server.subscribe(first, last, peer);
+
+            aj = Json::make_array();
+            {
+                Str prevkey;
+                for (auto itend = it.table_end();
+                     it != itend && it->key() < last; ++it)
+                    push_scan_pair(aj, prevkey, *it, compact);
+            }
+            rj[3].push_back(std::move(aj));
+            ++diff_.nsubscribe;
+        }
+        break;
+    case pq_rscan: {
+        // newest-first scan of [first, last), at most limit pairs;
+        // a cursor reply means resume with last = cursor
+        rj[2] = pq_ok;
+        first = j[2].as_s(), last = j[3].as_s();
+        count = j[4].to_u64();
+        if (!count || count > pq_scan_max_pairs)
+            count = pq_scan_max_pairs;
+        twait { server.validate(first, last, make_event(it)); }
+
+        auto rit = server.table_for(first, last).lower_bound(last);
+        assert(!aj.shared());
+        aj.clear();
+        while (rit != it) {
+            if (aj.size() == 2 * count) {
+                rj[4] = aj[aj.size() - 2];
+                break;
+            }
+            --rit;
+            aj.push_back(rit->key()).push_back(rit->value());
         }
         rj[3] = aj;
         ++diff_.nscan;
@@ -198,6 +424,34 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
         rj[2] = pq_ok;
         ++diff_.nnotify;
         break;
+    case pq_insert_batch:
+        if (unlikely(!j[2].is_a())) {
+            rj[2] = pq_fail;
+            break;
+        }
+        twait { server.insert_batch(batch_pairs(j[2]), make_event()); }
+        rj[2] = pq_ok;
+        diff_.ninsert += j[2].size() / 2;
+        break;
+    case pq_notify_batch: {
+        const Json& batch = j.get(2);
+        for (size_t i = 0; i + 1 < batch.size(); i += 2) {
+            if (!batch[i].is_s())
+                continue;
+            key = batch[i].as_s();
+            pq::Table& t = server.table_for(key);
+            // a batch can trail our unsubscribe or eviction of the range
+            if (!t.has_remote(key))
+                continue;
+            if (batch[i + 1].is_s())
+                t.insert(key, batch[i + 1].as_s());
+            else
+                t.erase(key);
+        }
+        rj[2] = pq_ok;
+        diff_.nnotify += batch.size() / 2;
+        break;
+    }
     case pq_stats:
         rj[2] = pq_ok;
         rj[3] = server.stats();
@@ -257,6 +511,12 @@ tamed void read_and_process_one(msgpack_fd* mpfd, pq::Server& server,
         key = j[2].as_s();
         rj[3] = noop_val;
         break;
+    case pq_multi:
+        if (!j[2].is_a())
+            break;
+        twait { server.multi(j[2], make_event(rj[3].value())); }
+        rj[2] = pq_ok;
+        break;
     }
 
  finish:
@@ -412,6 +672,19 @@ tamed void periodic_logger() {
 
 } // namespace
 
+// Serves the requests a peer sends over an interconnect made elsewhere;
+// unit tests use this to join servers within one process.
+void serve_interconnect(pq::Server& server, tamer::fd fd, pq::Interconnect* ic) {
+    ready_ = true;
+    connector(fd, ic->fd(), server);
+}
+
+// Serves the clients that connect to listenfd, as server_loop does.
+void serve_clients(pq::Server& server, tamer::fd listenfd) {
+    ready_ = true;
+    acceptor(listenfd, server);
+}
+
 tamed void server_loop(pq::Server& server, int port, bool kill,
                        const pq::Hosts* hosts, const pq::Host* me,
                        const pq::Partitioner* part, uint32_t round_robin) {
@@ -456,6 +729,8 @@ tamed void server_loop(pq::Server& server, int port, bool kill,
     }
 
     ready_ = true;
+    if (hosts)
+        server.replicate();
     interrupt_catcher();
 }
 
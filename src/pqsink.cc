@@ -15,7 +15,7 @@ Loadable::Loadable(Table* table) : table_(table) {
 Loadable::~Loadable() {
 }
 
-Evictable::Evictable() : evicted_(false), last_access_(0) {
+Evictable::Evictable() : evicted_(false), pinned_(false), last_access_(0) {
 }
 
 Evictable::~Evictable() {
@@ -38,7 +38,8 @@ JoinRange::JoinRange(Str first, Str last, Join* join)
 }
 
 SinkRange::SinkRange(Str first, Str last, Table* table)
-    : ServerRangeBase(first, last), table_(table) {
+    : ServerRangeBase(first, last), table_(table),
+      adaptive_(false), pull_(false), nread_(0), nwrite_(0) {
 }
 
 SinkRange::~SinkRange() {
@@ -78,6 +79,7 @@ bool SinkRange::add_sink(JoinRange* jr, Server& server,
     Sink* sink = new Sink(jr, this);
     sinks_.push_back(sink);
     sink->ref();
+    adaptive_ |= sink->adaptive_;
 
     validate_args va(ibegin(), iend(), server, now, sink, 
                      SourceRange::notify_insert, log, gr);    
@@ -87,7 +89,11 @@ bool SinkRange::add_sink(JoinRange* jr, Server& server,
 
     log |= ValidateRecord::compute;
 
-    return validate_step(va, 0);
+    // the initial computation must not park the new sink
+    sink->validating_ = true;
+    bool complete = validate_step(va, 0);
+    sink->validating_ = false;
+    return complete;
 }
 
 bool SinkRange::validate(Str first, Str last, Server& server,
@@ -95,6 +101,7 @@ bool SinkRange::validate(Str first, Str last, Server& server,
                          tamer::gather_rendezvous& gr) {
 
     bool complete = true;
+    count_read();
 
     for (auto sit = sinks_.begin(); sit != sinks_.end(); ++sit)
         complete &= (*sit)->validate(first, last, server, now, log, gr);
@@ -249,6 +256,35 @@ bool SinkRange::validate_step(validate_args& va, int joinpos) {
     return complete;
 }
 
+// Picks push or pull for the next period. Pushing costs a sink modification
+// per source write; pulling recomputes what the writes fed at most once per
+// read, and only if a write came in since the last one.
+void SinkRange::adapt() {
+    uint64_t size = 1;
+    for (auto sink : sinks_)
+        size += sink->data_.size();
+    uint64_t push_cost = nwrite_;
+    uint64_t pull_cost = std::min(nread_, nwrite_) * size;
+
+    if (!pull_ && push_cost > 2 * pull_cost)
+        pull_ = true;
+    else if (pull_ && pull_cost > 2 * push_cost)
+        pull_ = false;
+    nread_ = nwrite_ = 0;
+}
+
+// Recomputes the sinks whose results expire by horizon. Unlike validate(),
+// this is not a read, so it leaves the range's recency alone. Each sink
+// keeps validating until complete; gr hears when all of them are done.
+void SinkRange::refresh(uint64_t horizon, Server& server, uint64_t now,
+                        tamer::gather_rendezvous& gr) {
+    for (auto sink : sinks_)
+        if (sink->refresh_due(horizon, last_access())) {
+            sink->expires_at_ = now - 1;
+            server.refresh_sink(sink, gr.make_event());
+        }
+}
+
 void SinkRange::evict() {
     assert(table_);
     table_->evict_sink(this);
@@ -276,7 +312,8 @@ Restart::Restart(Sink* sink, int joinpos, const Match& m, int notifier)
 
 Sink::Sink(JoinRange* jr, SinkRange* sr)
     : valid_(true), validating_(false),
-      table_(sr->table_), hint_{nullptr}, dangerous_slot_(0),
+      adaptive_(jr->join() && jr->join()->adaptive()), table_(sr->table_),
+      hint_{nullptr}, dangerous_slot_(0),
       expires_at_(0), refcount_(0), data_free_(uintptr_t(-1)),
       jr_(jr), sr_(sr) {
 
@@ -295,6 +332,7 @@ Sink::Sink(JoinRange* jr, SinkRange* sr)
 }
 
 Sink::~Sink() {
+    unpark(false);
     clear_updates();
     if (hint_)
         hint_->deref();
@@ -308,6 +346,8 @@ void Sink::add_update(int joinpos, Str context, Str key, int notifier) {
     uint8_t kf[key_capacity], kl[key_capacity];
     int kflen = join()->expand_first(kf, join()->sink(), rm);
     int kllen = join()->expand_last(kl, join()->sink(), rm);
+    if (has_invalidate(Str(kf, kflen), Str(kl, kllen)))
+        return;
 
     IntermediateUpdate* iu = new IntermediateUpdate
         (Str(kf, kflen), Str(kl, kllen), this, joinpos, rm.match, notifier);
@@ -331,14 +371,33 @@ void Sink::add_invalidate(Str key) {
 }
 
 void Sink::add_invalidate(Str first, Str last) {
+    if (has_invalidate(first, last))
+        return;
+
+    // absorb overlapping updates, which would otherwise recompute some
+    // keys twice
+    LocalStr<24> f = first, l = last;
+    while (1) {
+        auto it = updates_.begin_overlaps(Str(f), Str(l));
+        if (it == updates_.end())
+            break;
+        IntermediateUpdate* iu = it.operator->();
+        updates_.erase(*iu);
+        if (iu->ibegin() < f)
+            f = iu->ibegin();
+        if (l < iu->iend())
+            l = iu->iend();
+        delete iu;
+    }
+
     IntermediateUpdate* iu = new IntermediateUpdate
-            (first, last, this, -1, Match(), SourceRange::notify_insert);
+            (f, l, this, -1, Match(), SourceRange::notify_insert);
     updates_.insert(*iu);
 
     if (valid()) {
-        table_->invalidate_dependents(first, last);
-        auto endit = table_->lower_bound(last);
-        for (auto it = table_->lower_bound(first); it != endit; )
+        table_->invalidate_dependents(f, l);
+        auto endit = table_->lower_bound(l);
+        for (auto it = table_->lower_bound(f); it != endit; )
             if (it->owner() == this)
                 it = table_->erase_invalid(it);
             else
@@ -347,6 +406,33 @@ void Sink::add_invalidate(Str first, Str last) {
     //std::cerr << *iu << "\n";
 }
 
+// Invalidates only the sink keys that could derive from keys in
+// [first, last) of source joinpos, given that source's result context.
+void Sink::add_invalidate(int joinpos, Str context, Str first, Str last) {
+    RangeMatch srm(first, last);
+    join()->assign_context(srm.match, context);
+    join()->source(joinpos).match_range(srm);
+    RangeMatch rm(ibegin(), iend(), srm.match, dangerous_slot_);
+    uint8_t kf[key_capacity], kl[key_capacity];
+    int kflen = join()->expand_first(kf, join()->sink(), rm);
+    int kllen = join()->expand_last(kl, join()->sink(), rm);
+
+    Str f(kf, kflen), l(kl, kllen);
+    if (f < ibegin())
+        f = ibegin();
+    if (iend() < l)
+        l = iend();
+    if (f < l)
+        add_invalidate(f, l);
+}
+
+bool Sink::has_invalidate(Str first, Str last) {
+    for (auto it = updates_.begin_contains(first); it != updates_.end(); ++it)
+        if (it->joinpos_ < 0 && last <= it->iend())
+            return true;
+    return false;
+}
+
 bool Sink::update_iu(Str first, Str last, IntermediateUpdate* iu, bool& remaining,
                           Server& server, uint64_t now, uint32_t& log,
                           tamer::gather_rendezvous& gr) {
@@ -427,12 +513,31 @@ bool Sink::restart(Str first, Str last, Server& server,
     return complete;
 }
 
+// Stops receiving writes from source until the next read.
+void Sink::park(SourceRange* source) {
+    source->ref();
+    parked_.push_back(parked_source{source, source->nwrite()});
+}
+
+// Releases parked sources. If credit, the writes they saw while this sink
+// was parked count toward its range's push/pull decision.
+void Sink::unpark(bool credit) {
+    for (auto& p : parked_) {
+        if (credit)
+            sr_->count_write(p.source->nwrite() - p.nwrite);
+        p.source->deref();
+    }
+    parked_.clear();
+}
+
 bool Sink::validate(Str first, Str last, Server& server,
                     uint64_t now, uint32_t& log, tamer::gather_rendezvous& gr) {
     bool complete = true;
 
     assert(!validating_);
     validating_ = true;
+    if (!parked_.empty())
+        unpark(true);
 
     if (unlikely(has_expired(now))) {
         assert(!join()->maintained());
@@ -479,6 +584,7 @@ void Sink::invalidate() {
         data_free_ = uintptr_t(-1);
 
         clear_updates();
+        unpark(false);
         valid_ = false;
 
         if (refcount_ == 0)
@@ -18,7 +18,7 @@ class JoinRange;
 class Sink;
 class Interconnect;
 
-class ServerRangeBase {
+class ServerRangeBase : public SlabAllocated {
   public:
     inline ServerRangeBase(Str first, Str last);
 
@@ -52,6 +52,8 @@ class Evictable : public lru_hook {
 
     inline void mark_evicted();
     inline bool evicted() const;
+    inline void pin();
+    inline bool pinned() const;
     inline uint64_t last_access() const;
     inline void set_last_access(uint64_t now);
     void unlink();
@@ -59,6 +61,7 @@ class Evictable : public lru_hook {
 
   private:
     bool evicted_;
+    bool pinned_;
     uint64_t last_access_;
 };
 
@@ -127,14 +130,30 @@ class SinkRange : public ServerRangeBase, public Evictable {
 
     inline bool valid(uint64_t now) const;
 
+    inline bool pull() const;
+    inline void count_read();
+    inline void count_write(uint32_t n = 1);
+
+    inline bool refresh_due(uint64_t horizon) const;
+    void refresh(uint64_t horizon, Server& server, uint64_t now,
+                 tamer::gather_rendezvous& gr);
+
     virtual void evict();
     virtual uint32_t priority() const;
 
+    enum { adapt_period = 64 };
+
   public:
     rblinks<SinkRange> rblinks_;
   private:
     Table* table_;
     local_vector<Sink*, 4> sinks_;
+    bool adaptive_;
+    bool pull_;
+    uint32_t nread_;
+    uint32_t nwrite_;
+
+    void adapt();
 
     struct validate_args;
     bool validate_step(validate_args& va, int joinpos);
@@ -168,6 +187,7 @@ class Sink {
 
     inline bool has_expired(uint64_t now) const;
     inline void set_expiration(uint64_t from);
+    inline bool refresh_due(uint64_t horizon, uint64_t last_access) const;
 
     inline void add_datum(Datum* d) const;
     inline void remove_datum(Datum* d) const;
@@ -176,6 +196,11 @@ class Sink {
     void add_update(int joinpos, Str context, Str key, int notifier);
     void add_invalidate(Str key);
     void add_invalidate(Str first, Str last);
+    void add_invalidate(int joinpos, Str context, Str first, Str last);
+    inline bool invalidated(Str key);
+    inline bool absorb_write();
+    void park(SourceRange* source);
+    void unpark(bool credit);
     void add_restart(int joinpos, const Match& match, int notifier);
     inline bool need_update() const;
     inline bool need_restart() const;
@@ -191,6 +216,7 @@ class Sink {
     inline Datum* hint() const;
 
     friend std::ostream& operator<<(std::ostream&, const Sink&);
+    friend class SinkRange;
 
     static uint64_t invalidate_hit_keys;
     static uint64_t invalidate_miss_keys;
@@ -198,6 +224,7 @@ class Sink {
   private:
     bool valid_;
     bool validating_;
+    bool adaptive_;
     Table* table_;
     mutable Datum* hint_;
     unsigned context_mask_;
@@ -206,6 +233,11 @@ class Sink {
     uint64_t expires_at_;
     interval_tree<IntermediateUpdate> updates_;
     std::list<Restart*> restarts_;
+    struct parked_source {
+        SourceRange* source;
+        uint32_t nwrite;
+    };
+    std::vector<parked_source> parked_;
     int refcount_;
     mutable uintptr_t data_free_;
     mutable local_vector<Datum*, 12> data_;
@@ -213,6 +245,7 @@ class Sink {
     JoinRange* jr_;
     SinkRange* sr_;
 
+    bool has_invalidate(Str first, Str last);
     bool update_iu(Str first, Str last, IntermediateUpdate* iu, bool& remaining,
                    Server& server, uint64_t now, uint32_t& log,
                    tamer::gather_rendezvous& gr);
@@ -329,6 +362,17 @@ inline bool Evictable::evicted() const {
     return evicted_;
 }
 
+// pinned objects stay off the LRU and are never evicted
+inline void Evictable::pin() {
+    pinned_ = true;
+    if (is_linked())
+        unlink();
+}
+
+inline bool Evictable::pinned() const {
+    return pinned_;
+}
+
 inline uint64_t Evictable::last_access() const {
     return last_access_;
 }
@@ -350,6 +394,27 @@ inline bool SinkRange::valid(uint64_t now) const {
     return true;
 }
 
+inline bool SinkRange::pull() const {
+    return pull_;
+}
+
+inline bool SinkRange::refresh_due(uint64_t horizon) const {
+    for (auto sink : sinks_)
+        if (sink->refresh_due(horizon, last_access()))
+            return true;
+    return false;
+}
+
+inline void SinkRange::count_read() {
+    if (adaptive_ && ++nread_ + nwrite_ >= adapt_period)
+        adapt();
+}
+
+inline void SinkRange::count_write(uint32_t n) {
+    if ((nwrite_ += n) + nread_ >= adapt_period)
+        adapt();
+}
+
 inline Join* JoinRange::join() const {
     return join_;
 }
@@ -416,6 +481,14 @@ inline void Sink::set_expiration(uint64_t from) {
         expires_at_ = from + jr_->join()->staleness();
 }
 
+// true if the results expire by horizon and were read during the second
+// half of their lifetime, which suggests they will be read again
+inline bool Sink::refresh_due(uint64_t horizon, uint64_t last_access) const {
+    uint64_t staleness = jr_->join()->staleness();
+    return valid_ && staleness && expires_at_ <= horizon
+        && last_access + staleness / 2 >= expires_at_;
+}
+
 inline void Sink::add_datum(Datum* d) const {
     assert(d->owner() == this);
     uintptr_t pos = data_free_;
@@ -440,6 +513,22 @@ inline bool Sink::need_update() const {
     return !updates_.empty();
 }
 
+// true if key lies in a range that add_invalidate has marked for
+// recomputation; modifications there would be redone by update()
+inline bool Sink::invalidated(Str key) {
+    return need_update() && has_invalidate(key, key);
+}
+
+// Counts a source write into this sink. Returns true if the sink's range
+// is pulling, in which case the source parks the sink instead of
+// delivering the write.
+inline bool Sink::absorb_write() {
+    if (!adaptive_)
+        return false;
+    sr_->count_write();
+    return sr_->pull() && !validating_;
+}
+
 inline bool Sink::need_restart() const {
     return !restarts_.empty();
 }
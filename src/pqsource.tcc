@@ -22,7 +22,8 @@ BloomFilter* make_bloom(Server& server, Str first, Str last) {
 }
 
 SourceRange::SourceRange(const parameters& p)
-    : ibegin_(p.first), iend_(p.last), join_(p.join), joinpos_(p.joinpos), purged_(false) {
+    : ibegin_(p.first), iend_(p.last), join_(p.join), joinpos_(p.joinpos),
+      result_keys_(nullptr), refcount_(0), nwrite_(0), purged_(false), dead_(false) {
     assert(table_name(p.first, p.last));
     if (!ibegin_.is_local())
         allocated_key_bytes += ibegin_.length();
@@ -42,24 +43,52 @@ SourceRange::SourceRange(const parameters& p)
 SourceRange::~SourceRange() {
     for (auto& r : results_)
         r.sink->deref();
+    delete result_keys_;
 }
 
 void SourceRange::kill() {
     join_->server().table_for(ibegin(), iend()).unlink_source(this);
-    delete this;
+    dead_ = true;
+    if (!refcount_)
+        delete this;
 }
 
 void SourceRange::take_results(SourceRange& r) {
     assert(join() == r.join());
     for (auto& rk : r.results_)
-        results_.push_back(std::move(rk));
+        // a partial revalidation re-adds sinks this range already feeds
+        if (has_result(rk))
+            rk.sink->deref();
+        else {
+            if (result_keys_)
+                result_keys_->find_insert(result_key(rk));
+            results_.push_back(std::move(rk));
+        }
     r.results_.clear();
 }
 
+// Short result lists are scanned. Long ones, as in a popular user's
+// fan-out, get a hash set of their (sink, context) keys instead.
+bool SourceRange::has_result(const result& rk) {
+    if (!result_keys_) {
+        if (results_.size() < result_scan_max) {
+            for (auto& r : results_)
+                if (r.sink == rk.sink && r.context == rk.context)
+                    return true;
+            return false;
+        }
+        result_keys_ = new HashTable<String, int>;
+        for (auto& r : results_)
+            result_keys_->find_insert(result_key(r));
+    }
+    return result_keys_->find(result_key(rk)) != result_keys_->end();
+}
+
 void SourceRange::remove_sink(Sink* sink, Str context) {
     assert(join() == sink->join());
     for (int i = 0; i != results_.size(); )
         if (results_[i].sink == sink && results_[i].context == context) {
+            forget_result(results_[i]);
             sink->deref();
             results_[i] = results_.back();
             results_.pop_back();
@@ -85,11 +114,12 @@ bool SourceRange::check_match(Str key) const {
 
 void SourceRange::notify(const Datum* src, const String& old_value, int notifier) {
     using std::swap;
+    ++nwrite_;
     result* endit = results_.end();
     for (result* it = results_.begin(); it != endit; ) {
         if (it + 1 != endit)
             (it + 1)->sink->prefetch();
-        if (it->sink->valid()) {
+        if (it->sink->valid() && !it->sink->absorb_write()) {
             it->sink->table()->prefetch();
             unsigned sink_mask = it->sink ? it->sink->context_mask() : 0;
             if (sink_mask)
@@ -97,9 +127,13 @@ void SourceRange::notify(const Datum* src, const String& old_value, int notifier
             if (it->context)
                 join_->expand_sink_key_context(it->context);
             join_->expand_sink_key_source(src->key(), sink_mask);
-            notify(join_->sink_key(), it->sink, src, old_value, notifier);
+            if (!it->sink->invalidated(join_->sink_key()))
+                notify(join_->sink_key(), it->sink, src, old_value, notifier);
             ++it;
         } else {
+            if (it->sink->valid())
+                park(*it);
+            forget_result(*it);
             it->sink->deref();
             swap(*it, endit[-1]);
             results_.pop_back();
@@ -110,6 +144,58 @@ void SourceRange::notify(const Datum* src, const String& old_value, int notifier
         const_cast<SourceRange*>(this)->kill();
 }
 
+bool SourceRange::deferrable() const {
+    return true;
+}
+
+// Like notify(), but appends each valid sink's modification to out and
+// its key to keys. This range, the sink and src are referenced until it
+// is applied.
+void SourceRange::defer(Datum* src, const String& old_value, int notifier,
+                        std::vector<deferred>& out, StringAccum& keys) {
+    ++nwrite_;
+    for (int i = 0; i != results_.size(); ) {
+        result& r = results_[i];
+        if (!r.sink->valid()) {
+            ++i;
+            continue;
+        }
+        if (r.sink->absorb_write()) {
+            // not killed even if now empty: the batch still holds this range
+            park(r);
+            forget_result(r);
+            r.sink->deref();
+            results_[i] = results_.back();
+            results_.pop_back();
+            continue;
+        }
+        ++i;
+        unsigned sink_mask = r.sink->context_mask();
+        if (sink_mask)
+            join_->expand_sink_key_context(r.sink->context());
+        if (r.context)
+            join_->expand_sink_key_context(r.context);
+        join_->expand_sink_key_source(src->key(), sink_mask);
+        Str sink_key = join_->sink_key();
+        if (r.sink->invalidated(sink_key))
+            continue;
+        ref();
+        r.sink->ref();
+        src->ref();
+        out.push_back(deferred{this, r.sink, src, old_value, notifier,
+                               keys.length(), sink_key.length()});
+        keys.append(sink_key.data(), sink_key.length());
+    }
+}
+
+// Parks a pulling sink. The keys this range feeds are marked for
+// recomputation, and the sink no longer sees this range's writes until
+// its next read recomputes them and adds it back.
+void SourceRange::park(result& r) {
+    r.sink->add_invalidate(joinpos_, r.context, ibegin(), iend());
+    r.sink->park(this);
+}
+
 void SourceRange::invalidate() {
     result* endit = results_.end();
     for (result* it = results_.begin(); it != endit; ++it)
@@ -118,6 +204,14 @@ void SourceRange::invalidate() {
     kill();
 }
 
+// Unlike invalidate(), keeps this range and its sinks. Each sink recomputes
+// just the keys that could derive from [first, last).
+void SourceRange::invalidate(Str first, Str last) {
+    for (auto& r : results_)
+        if (r.sink->valid())
+            r.sink->add_invalidate(joinpos_, r.context, first, last);
+}
+
 std::ostream& operator<<(std::ostream& stream, const SourceRange& r) {
     stream << "{" << "[" << r.ibegin() << ", " << r.iend() << "): "
            << typeid(r).name() << " ->";
@@ -140,15 +234,19 @@ tamed void UsingRange::notify(const Datum* d, const String&, int notifier) {
     if (!notifier)
         return;
 
+    ++nwrite_;
     result* endit = results_.end();
     for (result* it = results_.begin(); it != endit; ) {
-        if (it->sink->valid()) {
+        if (it->sink->valid() && !it->sink->absorb_write()) {
             it->sink->add_update(joinpos_, it->context, d->key(), notifier);
             if (!lazy_)
                 eager_update(it->sink);
             ++it;
         }
         else {
+            if (it->sink->valid())
+                park(*it);
+            forget_result(*it);
             it->sink->deref();
             swap(*it, endit[-1]);
             results_.pop_back();
@@ -186,6 +284,11 @@ void SubscribedRange::invalidate() {
     kill();
 }
 
+// subscribers drop whole remote ranges, so they hear about the whole range
+void SubscribedRange::invalidate(Str, Str) {
+    invalidate();
+}
+
 void SubscribedRange::kill() {
     server_.table_for(ibegin(), iend()).unlink_source(this);
     delete this;
@@ -198,10 +301,8 @@ bool SubscribedRange::check_match(Str) const {
 void SubscribedRange::notify(const Datum* src, const String&, int notifier) {
     for (result* it = results_.begin(); it != results_.end(); ++it) {
         RemoteSink* sink = reinterpret_cast<RemoteSink*>(it->sink);
-        if (notifier < 0)
-            sink->conn()->notify_erase(src->key(), tamer::event<>());
-        else
-            sink->conn()->notify_insert(src->key(), src->value(), tamer::event<>());
+        sink->conn()->notify(src->key(),
+                             notifier < 0 ? erase_marker() : src->value());
     }
 }
 
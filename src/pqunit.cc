@@ -9,10 +9,18 @@
 #endif
 #include "pqserver.hh"
 #include "pqjoin.hh"
+#include "pqclient.hh"
+#include "pqremoteclient.hh"
 #include "json.hh"
 #include "time.hh"
 #include "check.hh"
 #include "partitioner.hh"
+#include "btree_set.hh"
+#include "flat_interval_tree.hh"
+#include "sp_key.hh"
+#include "error.hh"
+#include "msgpack.hh"
+#include "pqrpc.hh"
 
 namespace  {
 
@@ -343,6 +351,86 @@ void test_count() {
     CHECK_EQ(server.count("j|", "j}"), size_t(0));
 }
 
+size_t walk_count(pq::Server& server, Str first, Str last) {
+    pq::Table& t = server.table_for(first, last);
+    size_t n = 0;
+    for (auto it = t.lower_bound(first); it != t.end() && it->key() < last; ++it)
+        ++n;
+    return n;
+}
+
+void check_counts(pq::Server& server, Str tname) {
+    const char* const ranges[][2] = {
+        {"|", "}"},
+        {"|00003", "|00007"},
+        {"|00003|0000000015", "|00007|0000000022"},
+        {"|00004|0000000015", "|00004|0000000022"},
+        {"|00002}", "|00009|"},
+        {"|00008|", "}"}
+    };
+    for (auto r = ranges; r != ranges + sizeof(ranges)/sizeof(ranges[0]); ++r) {
+        String first = String(tname) + (*r)[0], last = String(tname) + (*r)[1];
+        CHECK_EQ(server.count(first, last), walk_count(server, first, last));
+    }
+    String first = String(tname) + "|", last = String(tname) + "}";
+    CHECK_EQ(server.table_for(first, last).size(), walk_count(server, first, last));
+}
+
+void test_count_subtables() {
+    pq::Server server;
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse(
+        "t|<user>|<time>|<poster> = "
+        "copy p|<poster>|<time> "
+        "using s|<user>|<poster> "
+        "where user:5t, time:10, poster:5t"));
+    j.ref();
+    server.add_join("t|", "t}", &j);
+    CHECK_EQ(server.table_for("p|", "p}").triecut(), 7);
+    CHECK_EQ(server.table_for("t|", "t}").triecut(), 7);
+
+    for (int p = 0; p != 10; ++p)
+        for (int t = 10; t != 30; ++t)
+            server.insert(String("p|0000") + String(p) + "|00000000" + String(t), "x");
+    // shorter than the triecut, so stored beside the subtables
+    server.insert("p|1", "short");
+    for (int u = 0; u != 5; ++u)
+        for (int p = u; p != u + 5; ++p)
+            server.insert(String("s|0000") + String(u) + "|0000" + String(p), "1");
+
+    CHECK_EQ(server.count("p|", "p}"), size_t(201));
+    CHECK_EQ(server.count("p|00004|0000000015", "p|00004|0000000020"), size_t(5));
+    check_counts(server, "p");
+
+    // erases update every enclosing table
+    for (int p = 0; p != 10; p += 2)
+        for (int t = 10; t != 30; t += 3)
+            server.erase(String("p|0000") + String(p) + "|00000000" + String(t));
+    server.erase("p|1");
+    CHECK_EQ(server.count("p|", "p}"), size_t(165));
+    check_counts(server, "p");
+
+    // sink tables with subtables
+    for (int u = 0; u != 5; ++u)
+        server.validate(String("t|0000") + String(u) + "|", String("t|0000") + String(u) + "}");
+    CHECK_EQ(server.count("t|00001|", "t|00001}"),
+             server.count("p|00001|", "p|00006|"));
+    check_counts(server, "t");
+
+    // invalidation drops dependent sink keys
+    Str key = "p|00003|0000000011";
+    server.table_for(key).invalidate_dependents(key);
+    check_counts(server, "t");
+    check_counts(server, "p");
+
+    // evicting the sink ranges empties the sink subtables
+    while (server.evict_one())
+        /* do nothing */;
+    CHECK_EQ(server.count("t|", "t}"), size_t(0));
+    check_counts(server, "t");
+    check_counts(server, "p");
+}
+
 void test_recursive() {
     pq::Server server;
 
@@ -445,6 +533,49 @@ void test_annotation() {
     CHECK_EQ(server.count("f|00003|0000000001", "f|00003|0000000015"), size_t(4));
 }
 
+void test_refresh_ahead() {
+    pq::Server server;
+    server.insert("d|00001|00002", "1");
+    server.insert("d|00003|00002", "1");
+    server.insert("e|00002|0000000001", "e1");
+
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse("f|<d_id:5>|<time:10>|<e_id:5> = "
+                              "using d|<d_id>|<e_id> "
+                              "copy e|<e_id>|<time>"));
+    j.ref();
+    j.set_staleness(0.2);
+    server.add_join("f|", "f}", &j);
+
+    // f|00001 is read again late in its lifetime, f|00003 is not
+    server.validate("f|00001|", "f|00001}");
+    server.validate("f|00003|", "f|00003}");
+    usleep(120000);
+    server.validate("f|00001|", "f|00001}");
+    server.insert("e|00002|0000000002", "e2");
+
+    tamer::gather_rendezvous gr;
+    CHECK_EQ(server.refresh_expiring(tstamp() + 10000, 1000000, gr), 0U);
+    CHECK_EQ(server.refresh_expiring(tstamp() + 150000, 0, gr), 0U);
+    CHECK_EQ(server.refresh_expiring(tstamp() + 150000, 1000000, gr), 1U);
+    // all sources are local, so the refresh completes immediately
+    CHECK_TRUE(!gr.has_waiting());
+    CHECK_EQ(server.count("f|00001|", "f|00001}"), size_t(2));
+    CHECK_EQ(server.count("f|00003|", "f|00003}"), size_t(1));
+
+    // not read since the refresh
+    CHECK_EQ(server.refresh_expiring(tstamp() + 1000000, 1000000, gr), 0U);
+
+    // past the original expiration, the refreshed range is still served
+    usleep(100000);
+    server.insert("e|00002|0000000003", "e3");
+    server.validate("f|00001|", "f|00001}");
+    server.validate("f|00003|", "f|00003}");
+    CHECK_EQ(server.count("f|00001|", "f|00001}"), size_t(2));
+    CHECK_EQ(server.count("f|00003|", "f|00003}"), size_t(3));
+    CHECK_EQ(server.stats()["server_nrefresh"], 1);
+}
+
 void test_lazy_eager() {
 
     pq::Server server;
@@ -873,6 +1004,491 @@ void test_partitioner_analyze() {
     CHECK_EQ(parts.begin()->key, "t|00000000|00000003");
 }
 
+void test_replicated_partitions() {
+    pq::Partitioner* part = pq::Partitioner::make(
+        "{\"partitions\":[{\"prefix\":\"p|\",\"type\":\"decimal\","
+        "\"digits\":1,\"server\":[0,2]}],\"replicated\":[\"s|\",\"p|4\"]}",
+        0, 4, 3);
+    CHECK_EQ(part->owner("p|4"), 0);
+    CHECK_EQ(part->owner("p|5"), 1);
+    CHECK_EQ(part->owner("x"), 3);
+    CHECK_TRUE(part->is_replicated("p|42"));
+    CHECK_TRUE(part->is_replicated("p|4"));
+    CHECK_TRUE(part->is_replicated("s|"));
+    CHECK_TRUE(part->is_replicated("s|zz"));
+    CHECK_TRUE(!part->is_replicated("p|5"));
+    CHECK_TRUE(!part->is_replicated("p|"));
+    CHECK_TRUE(!part->is_replicated("s"));
+    CHECK_TRUE(!part->is_replicated(""));
+    CHECK_EQ(part->replicated().size(), size_t(2));
+
+    Json j = Json::parse(part->unparse());
+    CHECK_EQ(j["replicated"].unparse(), "[\"p|4\",\"s|\"]");
+    pq::partition_set ps(3, j);
+    CHECK_TRUE(ps.is_replicated("p|40"));
+    CHECK_EQ(ps.find("p|5").server(), 1);
+    delete part;
+}
+
+void test_relay_parent() {
+    pq::Partitioner* part = pq::Partitioner::make("twitternew", 2, 12, -1);
+    CHECK_EQ(part->relay_parent(0, 5, 0), 0);
+    CHECK_EQ(part->relay_parent(1, 0, 3), 1);
+
+    for (int owner = 0; owner < 12; ++owner) {
+        std::vector<int> nchildren(12, 0);
+        for (int s = 2; s < 12; ++s) {
+            if (s == owner)
+                continue;
+            int p = part->relay_parent(owner, s, 3), hops = 0;
+            CHECK_TRUE(p != s);
+            ++nchildren[p];
+            while (p != owner && hops < 12) {
+                p = part->relay_parent(owner, p, 3);
+                ++hops;
+            }
+            CHECK_EQ(p, owner);
+        }
+        for (int s = 0; s < 12; ++s)
+            CHECK_TRUE(nchildren[s] <= 3);
+    }
+    delete part;
+}
+
+void test_binary_keys() {
+    using pq::make_binary_spkey;
+    using pq::make_binary_spkey_last;
+    String k1 = make_binary_spkey("p", 2U, 255U), k2 = make_binary_spkey("p", 2U, 256U);
+    CHECK_EQ(k1.length(), 11);
+    CHECK_TRUE(k1 < k2);
+    CHECK_EQ(pq::extract_binary_spkey<uint32_t>(2, k2), 256U);
+    CHECK_EQ(pq::extract_binary_spkey<uint32_t>(3, k2), 0U);
+
+    pq::Server server;
+    server.insert(make_binary_spkey("f", 1U, 2U), "1");
+    server.insert(make_binary_spkey("p", 2U, 1U), "Hello,");
+    server.insert(make_binary_spkey("p", 2U, 300U), "world");
+    server.insert(make_binary_spkey("p", 3U, 2U), "Should not appear");
+
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse("t|<subscriber:4n>|<time:4n>|<poster:4n> = "
+                              "using f|<subscriber>|<poster> "
+                              "copy p|<poster>|<time>"));
+    j.ref();
+    server.add_join("t|", "t}", &j);
+
+    String first = make_binary_spkey("t", 1U, 2U), last = make_binary_spkey_last("t", 1U);
+    server.validate(first, last);
+    CHECK_EQ(server.count(first, last), size_t(1));
+    CHECK_EQ(server[make_binary_spkey("t", 1U, 300U, 2U)].value(), "world");
+
+    pq::Match m;
+    String fkey = make_binary_spkey("f", 1U, 2U);
+    j.source(0).match(fkey, m);
+    CHECK_EQ(j.unparse_match(m).unparse(), "{\"subscriber\":1,\"poster\":2}");
+
+    pq::Join bad;
+    SilentErrorHandler errh;
+    CHECK_TRUE(!bad.assign_parse("t|<x:3n> = copy p|<x>", &errh));
+
+    pq::Partitioner* part = pq::Partitioner::make("twitternew", 4, -1);
+    CHECK_EQ(part->owner(make_binary_spkey("t", 0U)), 0);
+    CHECK_EQ(part->owner(make_binary_spkey("t", 0xFFFFFFFFU)), 3);
+    delete part;
+}
+
+void test_reverse_scan() {
+    pq::Server server;
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse(
+        "t|<user>|<time>|<poster> = "
+        "copy p|<poster>|<time> "
+        "using s|<user>|<poster> "
+        "where user:5t, time:10, poster:5t"));
+    j.ref();
+    server.add_join("t|", "t}", &j);
+
+    std::pair<const char*, const char*> values[] = {
+        {"s|00001|00002", "1"},
+        {"s|00001|10000", "1"},
+        {"p|00002|0000000001", "Hello,"},
+        {"p|00002|0000000022", "Which is awesome"},
+        {"p|10000|0000000010", "My name is"},
+        {"p|10000|0000000018", "Jennifer Jones"},
+        {"p|10001|0000000019", "Not followed"}
+    };
+    for (auto it = values; it != values + sizeof(values)/sizeof(values[0]); ++it)
+        server.insert(it->first, it->second);
+
+    // iterating backwards crosses subtables
+    pq::Table& p = server.table_for("p|", "p}");
+    std::vector<String> keys;
+    for (auto it = p.begin(); it != p.end(); ++it)
+        keys.push_back(it->key());
+    CHECK_EQ(keys.size(), size_t(5));
+    auto rit = p.end();
+    for (auto kit = keys.rbegin(); kit != keys.rend(); ++kit)
+        CHECK_EQ((--rit)->key(), *kit);
+    CHECK_TRUE(rit == p.begin());
+
+    pq::DirectClient client(server);
+    pq::DirectClient::rscan_result rr;
+    tamer::rendezvous<> r;
+    tamer::event<pq::DirectClient::rscan_result> done = r.make_event(rr);
+    client.rscan("t|00001|0000000001", "t|00001}", 2, done);
+    CHECK_EQ(rr.size(), size_t(2));
+    CHECK_EQ(rr.begin()->key(), "t|00001|0000000022|00002");
+    CHECK_EQ((++rr.begin())->key(), "t|00001|0000000018|10000");
+
+    done = r.make_event(rr);
+    client.rscan("t|00001|0000000001", "t|00001}", 0, done);
+    CHECK_EQ(rr.size(), size_t(4));
+    CHECK_EQ((--rr.end())->key(), "t|00001|0000000001|00002");
+}
+
+void test_multi() {
+    pq::Server server;
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse(
+        "t|<user>|<time>|<poster> = "
+        "copy p|<poster>|<time> "
+        "using s|<user>|<poster> "
+        "where user:5t, time:10, poster:5t"));
+    j.ref();
+    server.add_join("t|", "t}", &j);
+    server.insert("s|00001|00002", "1");
+    server.insert("p|00002|0000000001", "Hello,");
+
+    pq::DirectClient client(server);
+    Json ops = Json::array(
+        Json::array(pq_insert, "p|00002|0000000022", "Which is awesome"),
+        Json::array(pq_get, "p|00002|0000000001"),
+        Json::array(pq_count, "t|00001|", "t|00001}"),
+        Json::array(pq_scan, "t|00001|0000000010", "t|00001}"),
+        Json::array(pq_scan, "t|00001|", "t|00001}", Json(), 1),
+        Json::array(pq_erase, "p|00002|0000000001"),
+        Json::array(pq_get, "p|00002|0000000001"),
+        Json::array(pq_get, 12),
+        Json::array(pq_scan, "t|00001|0000000010", "t|00001}", Json(), 5));
+    Json res;
+    tamer::rendezvous<> r;
+    client.multi(ops, r.make_event(res));
+    CHECK_EQ(res.size(), size_t(9));
+    CHECK_EQ(res[1].to_s(), "Hello,");
+    CHECK_EQ(res[2].to_u64(), uint64_t(2));
+    CHECK_EQ(res[3].unparse(), "[\"t|00001|0000000022|00002\",\"Which is awesome\"]");
+    CHECK_EQ(res[4].unparse(), "[[\"t|00001|0000000001|00002\",\"Hello,\"],\"t|00001|0000000001|00002\"]");
+    CHECK_EQ(res[6].to_s(), "");
+    CHECK_TRUE(res[7].is_null());
+    CHECK_EQ(res[8].unparse(), "[[\"t|00001|0000000022|00002\",\"Which is awesome\"],null]");
+    CHECK_TRUE(!server.find("p|00002|0000000001"));
+
+    std::vector<String> keys{"p|00002|0000000022", "p|00002|0000000001",
+                             "t|00001|0000000022|00002"}, values;
+    client.get(keys, r.make_event(values));
+    CHECK_EQ(values.size(), size_t(3));
+    CHECK_EQ(values[0], "Which is awesome");
+    CHECK_EQ(values[1], "");
+    CHECK_EQ(values[2], "Which is awesome");
+}
+
+String scan_unparse(pq::Server& server, Str first, Str last) {
+    StringAccum sa;
+    auto it = server.validate(first, last);
+    for (auto itend = it.table_end(); it != itend && it->key() < last; ++it)
+        sa << it->key() << '=' << it->value() << ' ';
+    return sa.take_string();
+}
+
+void test_insert_batch() {
+    pq::Server server[2];
+    pq::Join j[2], k[2];
+    for (int i = 0; i != 2; ++i) {
+        CHECK_TRUE(j[i].assign_parse("t|<user:5>|<time:10>|<poster:5> = "
+                                     "copy p|<poster>|<time> "
+                                     "using s|<user>|<poster>"));
+        j[i].ref();
+        server[i].add_join("t|", "t}", &j[i]);
+        CHECK_TRUE(k[i].assign_parse("k|<user> = count p|<poster>|<time> "
+                                     "using s|<user>|<poster> "
+                                     "where user:5, poster:5, time:10"));
+        k[i].ref();
+        server[i].add_join("k|", "k}", &k[i]);
+    }
+
+    // server[0] takes one key at a time, server[1] the same keys in batches
+    boost::mt19937 gen(7);
+    char buf[64];
+    std::vector<std::pair<String, String> > kvs;
+    for (int i = 0; i != 100; ++i) {
+        sprintf(buf, "s|%05u|%05u", unsigned(gen() % 20), unsigned(gen() % 20));
+        kvs.emplace_back(buf, "1");
+    }
+    for (auto& kv : kvs)
+        server[0].insert(kv.first, kv.second);
+    server[1].insert_batch(kvs);
+
+    for (int i = 0; i != 2; ++i) {
+        server[i].validate("t|", "t}");
+        server[i].validate("k|", "k}");
+    }
+
+    // repeated keys, and keys for tables without sources
+    kvs.clear();
+    for (int i = 0; i != 1000; ++i) {
+        sprintf(buf, "%c|%05u|%010u", i % 10 ? 'p' : 'x',
+                unsigned(gen() % 20), unsigned(gen() % 300));
+        kvs.emplace_back(buf, String(i));
+    }
+    for (auto& kv : kvs)
+        server[0].insert(kv.first, kv.second);
+    pq::DirectClient client(server[1]);
+    tamer::rendezvous<> r;
+    client.insert_batch(kvs, r.make_event());
+
+    for (const char* t : {"p", "s", "t", "k", "x"}) {
+        String first = String(t) + "|", last = String(t) + "}";
+        CHECK_EQ(scan_unparse(server[1], first, last),
+                 scan_unparse(server[0], first, last));
+    }
+    CHECK_TRUE(server[1].count("t|", "t}") > 100);
+}
+
+void test_invalidate_key() {
+    pq::Server server[2];
+    pq::Join j[2], k[2];
+    for (int i = 0; i != 2; ++i) {
+        CHECK_TRUE(j[i].assign_parse("t|<user:5>|<time:10>|<poster:5> = "
+                                     "copy p|<poster>|<time> "
+                                     "using s|<user>|<poster>"));
+        j[i].ref();
+        server[i].add_join("t|", "t}", &j[i]);
+        CHECK_TRUE(k[i].assign_parse("k|<user> = count p|<poster>|<time> "
+                                     "using s|<user>|<poster> "
+                                     "where user:5, poster:5, time:10"));
+        k[i].ref();
+        server[i].add_join("k|", "k}", &k[i]);
+
+        for (int u = 0; u != 5; ++u) {
+            server[i].insert(String("s|0000") + String(u) + "|00008", "1");
+            server[i].insert(String("s|0000") + String(u) + "|00009", "1");
+        }
+        server[i].insert("s|00005|00008", "1");
+        for (int t = 0; t != 10; ++t) {
+            server[i].insert(String("p|00008|000000000") + String(t), "x");
+            server[i].insert(String("p|00009|000000000") + String(t), "y");
+        }
+        server[i].validate("t|", "t}");
+        server[i].validate("k|", "k}");
+    }
+    CHECK_EQ(server[0].count("t|", "t}"), size_t(110));
+    CHECK_EQ(server[0].count("k|", "k}"), size_t(6));
+
+    // only sink keys derived from the invalidated key are dropped
+    Str key = "p|00009|0000000003";
+    server[0].table_for(key).invalidate_dependents(key);
+    server[0].table_for(key).invalidate_dependents(key);
+    CHECK_EQ(server[0].count("t|", "t}"), size_t(105));
+    CHECK_EQ(server[0].count("k|", "k}"), size_t(1));
+
+    // writes in and out of the invalidated range before revalidation
+    for (int i = 0; i != 2; ++i) {
+        server[i].insert(key, "z");
+        server[i].insert("p|00009|0000000010", "y");
+        server[i].insert("p|00008|0000000011", "x");
+    }
+    for (int i = 0; i != 2; ++i) {
+        server[i].validate("t|", "t}");
+        server[i].validate("k|", "k}");
+    }
+    CHECK_EQ(scan_unparse(server[0], "t|", "t}"),
+             scan_unparse(server[1], "t|", "t}"));
+    CHECK_EQ(scan_unparse(server[0], "k|", "k}"),
+             scan_unparse(server[1], "k|", "k}"));
+    CHECK_EQ(server[0].find("k|00000")->value(), "22");
+    CHECK_EQ(server[0].find("k|00005")->value(), "11");
+}
+
+void test_invalidate_fanout() {
+    pq::Server server;
+    pq::Join k;
+    CHECK_TRUE(k.assign_parse("k|<user> = count p|<poster>|<time> "
+                              "using s|<user>|<poster> "
+                              "where user:5, poster:5, time:10"));
+    k.ref();
+    server.add_join("k|", "k}", &k);
+
+    // enough followers that the source range hashes its sinks
+    char buf[32];
+    for (int u = 0; u != 40; ++u) {
+        sprintf(buf, "s|%05d|00008", u);
+        server.insert(buf, "1");
+    }
+    for (int t = 0; t != 10; ++t) {
+        sprintf(buf, "p|00008|%010d", t);
+        server.insert(buf, "x");
+    }
+    server.validate("k|", "k}");
+    CHECK_EQ(server.find("k|00039")->value(), "10");
+
+    // revalidating re-adds every sink to the poster's source range once
+    Str key = "p|00008|0000000003";
+    server.table_for(key).invalidate_dependents(key);
+    server.validate("k|", "k}");
+    server.insert("p|00008|0000000020", "x");
+    for (int u = 0; u != 40; ++u) {
+        sprintf(buf, "k|%05d", u);
+        CHECK_EQ(server.find(buf)->value(), "11");
+    }
+
+    server.insert("s|00040|00008", "1");
+    server.validate("k|", "k}");
+    server.insert("p|00008|0000000021", "x");
+    CHECK_EQ(server.find("k|00000")->value(), "12");
+    CHECK_EQ(server.find("k|00040")->value(), "12");
+}
+
+void test_adaptive_sink() {
+    // server[0] adapts, server[1] always pushes
+    pq::Server server[2];
+    pq::Join j[2], k[2];
+    for (int i = 0; i != 2; ++i) {
+        String mode = i ? "push " : "adaptive ";
+        CHECK_TRUE(j[i].assign_parse("t|<user:5>|<time:10>|<poster:5> = " + mode +
+                                     "copy p|<poster>|<time> "
+                                     "using s|<user>|<poster>"));
+        j[i].ref();
+        server[i].add_join("t|", "t}", &j[i]);
+        CHECK_TRUE(k[i].assign_parse("k|<user> = " + mode +
+                                     "count p|<poster>|<time> "
+                                     "using s|<user>|<poster> "
+                                     "where user:5, poster:5, time:10"));
+        k[i].ref();
+        server[i].add_join("k|", "k}", &k[i]);
+        CHECK_EQ(j[i].adaptive(), !i);
+        CHECK_TRUE(j[i].maintained());
+
+        server[i].insert("s|00000|00009", "1");
+        server[i].insert("s|00001|00009", "1");
+        server[i].insert("s|00001|00008", "1");
+    }
+
+    char buf[64];
+    int time = 0;
+    auto post = [&](const char* poster) {
+        sprintf(buf, "p|%s|%010d", poster, ++time);
+        for (int i = 0; i != 2; ++i)
+            server[i].insert(buf, "x");
+    };
+    auto read = [&](int i, const char* user) {
+        String t = String("t|") + user, k = String("k|") + user;
+        server[i].validate(t + "|", t + "}");
+        server[i].validate(k, k + "}");
+    };
+
+    for (int n = 0; n != 10; ++n)
+        post("00009");
+    for (int i = 0; i != 2; ++i)
+        for (const char* user : {"00000", "00001"})
+            read(i, user);
+    CHECK_EQ(server[0].count("t|00000|", "t|00000}"), size_t(10));
+
+    // writes with no reads switch 00000 to pull; 00001 is read after each
+    for (int n = 0; n != 200; ++n) {
+        post(n % 5 ? "00009" : "00008");
+        read(0, "00001");
+        read(1, "00001");
+    }
+    CHECK_EQ(server[0].count("t|00000|", "t|00000}"), size_t(0));
+    CHECK_EQ(server[0].count("t|00001|", "t|00001}"), size_t(210));
+    CHECK_EQ(server[1].count("t|00000|", "t|00000}"), size_t(170));
+
+    for (int i = 0; i != 2; ++i)
+        read(i, "00000");
+    CHECK_EQ(scan_unparse(server[0], "t|", "t}"),
+             scan_unparse(server[1], "t|", "t}"));
+
+    // frequent reads of a large range switch it back to push
+    for (int n = 0; n != 200; ++n) {
+        if (n % 4 == 0)
+            post("00009");
+        read(0, "00000");
+    }
+    post("00009");
+    CHECK_EQ(server[0].count("t|00000|", "t|00000}"),
+             server[1].count("t|00000|", "t|00000}"));
+
+    for (int i = 0; i != 2; ++i)
+        for (const char* user : {"00000", "00001"})
+            read(i, user);
+    CHECK_EQ(scan_unparse(server[0], "t|", "t}"),
+             scan_unparse(server[1], "t|", "t}"));
+    CHECK_EQ(server[0].find("k|00000")->value(), "221");
+    CHECK_EQ(server[0].find("k|00001")->value(), "261");
+    CHECK_EQ(server[1].find("k|00001")->value(), "261");
+}
+
+void test_adaptive_park() {
+    // a pulling range recomputes only what the written source feeds
+    pq::Server server[2];
+    pq::Join j[2];
+    for (int i = 0; i != 2; ++i) {
+        String mode = i ? "push " : "adaptive ";
+        CHECK_TRUE(j[i].assign_parse("c|<user:5>|<poster:5>|<time:10> = " + mode +
+                                     "copy p|<poster>|<time> "
+                                     "using s|<user>|<poster>"));
+        j[i].ref();
+        server[i].add_join("c|", "c}", &j[i]);
+        server[i].insert("s|00000|00008", "1");
+        server[i].insert("s|00000|00009", "1");
+    }
+
+    char buf[64];
+    int time = 0;
+    auto post = [&](const char* poster) {
+        sprintf(buf, "p|%s|%010d", poster, ++time);
+        for (int i = 0; i != 2; ++i)
+            server[i].insert(buf, "x");
+    };
+    auto read = [&](int i) {
+        server[i].validate("c|00000|", "c|00000}");
+    };
+
+    for (int n = 0; n != 10; ++n)
+        post(n % 2 ? "00009" : "00008");
+    read(0);
+    read(1);
+    for (int n = 0; n != 100; ++n)
+        post("00009");
+    CHECK_EQ(server[0].count("c|00000|00008|", "c|00000|00008}"), size_t(5));
+    CHECK_EQ(server[0].count("c|00000|00009|", "c|00000|00009}"), size_t(0));
+
+    read(0);
+    CHECK_EQ(server[0].count("c|00000|00009|", "c|00000|00009}"), size_t(105));
+    for (int n = 0; n != 10; ++n)
+        post("00008");
+    read(0);
+    read(1);
+    CHECK_EQ(scan_unparse(server[0], "c|", "c}"),
+             scan_unparse(server[1], "c|", "c}"));
+}
+
+void test_compact_scan() {
+    Json compact = Json::array(0, "t|00001|0000000022|00002", "a",
+                               16, "18|10000", "b",
+                               8, "1|0000000001|00002", "c");
+    Json pairs = pq::RemoteClient::expand_scan(compact);
+    CHECK_EQ(pairs.unparse(), "[\"t|00001|0000000022|00002\",\"a\","
+             "\"t|00001|0000000018|10000\",\"b\","
+             "\"t|00001|1|0000000001|00002\",\"c\"]");
+    CHECK_TRUE(pairs[0].as_s().data() + pairs[0].as_s().length()
+               == pairs[2].as_s().data());
+
+    Json plain = Json::array("a|1", "x", "a|2", "y");
+    CHECK_EQ(pq::RemoteClient::expand_scan(plain).unparse(), plain.unparse());
+    CHECK_EQ(pq::RemoteClient::expand_scan(Json::make_array()).size(), size_t(0));
+}
+
 void test_cross() {
     pq::Server server;
     pq::Join j1, j2;
@@ -1238,6 +1854,556 @@ bb|<bid> = copy b|<bid> where bid:3"));
     CHECK_EQ(server["kk|b"].value(), "3");
 }
 
+class StoreItem : public pq::pequod_set_base_hook, public pq::KeyHook<StoreItem> {
+  public:
+    explicit StoreItem(Str key)
+        : key_(key) {
+    }
+    Str key() const {
+        return key_;
+    }
+  private:
+    LocalStr<24> key_;
+};
+
+inline bool operator<(const StoreItem& a, const StoreItem& b) {
+    return a.key() < b.key();
+}
+
+void test_btree_store() {
+    // narrow nodes so splits and leaf removal happen often
+    typedef btree_set<StoreItem, 4> store_type;
+    store_type store;
+    std::set<String> model;
+    boost::mt19937 gen(1);
+    char buf[32];
+
+    for (int i = 0; i < 40000; ++i) {
+        sprintf(buf, "t|%05u|%u", unsigned(gen() % 400), unsigned(gen() % 100));
+        Str key(buf);
+        store_type::insert_commit_data cd;
+        auto p = store.insert_check(key, pq::KeyCompare(), cd);
+        CHECK_EQ(p.second, model.find(key) == model.end());
+        if (p.second) {
+            store.insert_commit(*new StoreItem(key), cd);
+            model.insert(key);
+        } else if (gen() % 2) {
+            StoreItem* x = p.first.operator->();
+            auto next = store.erase(p.first);
+            CHECK_TRUE(next == store.lower_bound(key, pq::KeyCompare()));
+            delete x;
+            model.erase(key);
+        }
+    }
+    CHECK_EQ(store.size(), model.size());
+
+    auto mit = model.begin();
+    size_t rank = 0;
+    for (auto it = store.begin(); it != store.end(); ++it, ++mit, ++rank) {
+        CHECK_EQ(it->key(), *mit);
+        CHECK_EQ(store.rank(it), rank);
+    }
+    CHECK_TRUE(mit == model.end());
+    CHECK_EQ(store.rank(store.end()), model.size());
+    CHECK_EQ(store.distance(store.lower_bound(Str("t|00100"), pq::KeyCompare()),
+                            store.lower_bound(Str("t|00300"), pq::KeyCompare())),
+             size_t(std::distance(model.lower_bound("t|00100"),
+                                  model.lower_bound("t|00300"))));
+
+    auto it = store.end();
+    for (auto rmit = model.rbegin(); rmit != model.rend(); ++rmit) {
+        --it;
+        CHECK_EQ(it->key(), *rmit);
+    }
+    CHECK_TRUE(it == store.begin());
+
+    // postfix and reverse iteration
+    CHECK_EQ((it++)->key(), *model.begin());
+    CHECK_EQ(it->key(), *std::next(model.begin()));
+    CHECK_EQ((it--)->key(), *std::next(model.begin()));
+    CHECK_TRUE(it == store.begin());
+    CHECK_EQ(std::prev(store.end())->key(), *model.rbegin());
+    CHECK_EQ(store.rbegin()->key(), *model.rbegin());
+    CHECK_EQ(size_t(std::distance(store.rbegin(), store.rend())), model.size());
+
+    // iterators survive unrelated modifications
+    it = store.lower_bound(Str("t|00200"), pq::KeyCompare());
+    String at(it->key());
+    for (int i = 0; i < 1000; ++i) {
+        sprintf(buf, "t|%05u|%u", unsigned(gen() % 400), unsigned(100 + i));
+        store.insert_before(store.end(), *new StoreItem(Str(buf)));
+    }
+    CHECK_EQ(it->key(), at);
+    ++it;
+    CHECK_TRUE(at < it->key());
+
+    size_t n = 0;
+    while (StoreItem* x = store.unlink_leftmost_without_rebalance()) {
+        delete x;
+        ++n;
+    }
+    CHECK_EQ(n, model.size() + 1000);
+    CHECK_TRUE(store.empty() && store.begin() == store.end());
+
+    // keys sharing a prefix
+    btree_set<StoreItem, 4> sub;
+    sub.set_key_prefix("t|00007|");
+    for (int i = 0; i < 100; ++i) {
+        sprintf(buf, "t|00007|%05u", unsigned(gen() % 1000));
+        pq::KeyCompare compare;
+        btree_set<StoreItem, 4>::insert_commit_data cd;
+        if (sub.insert_check(Str(buf), compare, cd).second)
+            sub.insert_commit(*new StoreItem(Str(buf)), cd);
+    }
+    for (auto it = sub.begin(); it != sub.end(); ) {
+        auto next = it;
+        ++next;
+        CHECK_TRUE(next == sub.end() || it->key() < next->key());
+        CHECK_TRUE(sub.find(it->key(), pq::KeyCompare()) == it);
+        it = next;
+    }
+    CHECK_TRUE(sub.lower_bound(Str("t|00006|99999"), pq::KeyCompare()) == sub.begin());
+    CHECK_TRUE(sub.lower_bound(Str("t|00007"), pq::KeyCompare()) == sub.begin());
+    CHECK_TRUE(sub.lower_bound(Str("t|00007}"), pq::KeyCompare()) == sub.end());
+    CHECK_TRUE(sub.lower_bound(Str("t|00008|"), pq::KeyCompare()) == sub.end());
+    while (StoreItem* x = sub.unlink_leftmost_without_rebalance())
+        delete x;
+}
+
+template <typename S>
+Json run_store_bench(const std::vector<StoreItem*>& items,
+                     const std::vector<String>& probes) {
+    S store;
+    typename S::insert_commit_data cd;
+    struct rusage ru[2];
+    Json stats;
+
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (StoreItem* x : items)
+        if (store.insert_check(x->key(), pq::KeyCompare(), cd).second)
+            store.insert_commit(*x, cd);
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("insert", to_real(ru[1].ru_utime - ru[0].ru_utime));
+
+    size_t found = 0;
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (int r = 0; r < 4; ++r)
+        for (auto& k : probes)
+            found += store.find(k, pq::KeyCompare()) != store.end();
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("lookup", to_real(ru[1].ru_utime - ru[0].ru_utime));
+
+    size_t scanned = 0;
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (auto& k : probes) {
+        auto it = store.lower_bound(Str(k).prefix(9), pq::KeyCompare());
+        for (int i = 0; i < 50 && it != store.end(); ++i, ++it)
+            scanned += it->key().length();
+    }
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("scan", to_real(ru[1].ru_utime - ru[0].ru_utime));
+
+    mandatory_assert(found && scanned);
+    while (store.unlink_leftmost_without_rebalance())
+        /* do nothing */;
+    return stats;
+}
+
+void test_store_bench() {
+    // timeline-shaped keys inserted in random order
+    const int nitems = 2000000;
+    boost::mt19937 gen(7);
+    std::vector<StoreItem*> items;
+    std::vector<String> probes;
+    char buf[40];
+    for (int i = 0; i < nitems; ++i) {
+        sprintf(buf, "t|%07u|%010u|%07u", unsigned(gen() % 100000),
+                unsigned(gen() % 1000000000), unsigned(gen() % 100000));
+        items.push_back(new StoreItem(Str(buf)));
+        if (i % 4 == 0)
+            probes.push_back(String(buf));
+    }
+    std::random_shuffle(probes.begin(), probes.end());
+
+    Json stats;
+    stats.set("rbtree", run_store_bench<boost::intrusive::set<StoreItem> >(items, probes));
+    stats.set("btree", run_store_bench<btree_set<StoreItem> >(items, probes));
+    std::cout << stats.unparse(Json::indent_depth(4)) << "\n";
+
+    for (StoreItem* x : items)
+        delete x;
+}
+
+// Decode a request and encode its reply as the server loop does, once
+// through Json and once through msgpack::flat_array and a direct unparser.
+// *_bytes is the heap a request holds once its reply is encoded, measured
+// on the second request so the reused StringAccum has already grown.
+Json run_rpc_decode_bench(const String& req, const std::vector<String>& values,
+                          bool is_array) {
+    const int nreq = 1000000;
+    StringAccum sa;
+    msgpack::unparser<StringAccum> up(sa);
+    struct rusage ru[2];
+    uint64_t base = 0, held[2] = {0, 0};
+    size_t total[2] = {0, 0};
+    Json stats;
+
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (int i = 0; i != nreq; ++i) {
+        if (i == 1)
+            base = pq::mem_other_size;
+        Json j = msgpack::parse(req);
+        Json rj = Json::array(-j[0].as_i(), j[1], pq_ok, Json());
+        if (is_array) {
+            Json aj = Json::make_array();
+            for (auto& v : values)
+                aj.push_back(v);
+            rj[3] = aj;
+        } else if (!values.empty())
+            rj[3] = values[0];
+        sa.clear();
+        msgpack::unparse(sa, rj);
+        total[0] += sa.length();
+        if (i == 1)
+            held[0] = pq::mem_other_size - base;
+    }
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("json_bytes", held[0])
+        .set("json_time", to_real(ru[1].ru_utime - ru[0].ru_utime));
+
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (int i = 0; i != nreq; ++i) {
+        if (i == 1)
+            base = pq::mem_other_size;
+        msgpack::flat_array fa;
+        mandatory_assert(fa.parse(req.ubegin(), req.uend(), req));
+        sa.clear();
+        up << msgpack::array(4) << -int(fa.as_i(0)) << fa.as_i(1) << int(pq_ok);
+        if (is_array) {
+            up << msgpack::array(values.size());
+            for (auto& v : values)
+                up << v;
+        } else if (!values.empty())
+            up << values[0];
+        else
+            up.null();
+        total[1] += sa.length();
+        if (i == 1)
+            held[1] = pq::mem_other_size - base;
+    }
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("flat_bytes", held[1])
+        .set("flat_time", to_real(ru[1].ru_utime - ru[0].ru_utime));
+
+    mandatory_assert(total[0] == total[1]);
+    return stats;
+}
+
+void test_rpc_decode_bench() {
+    String key("t|00001234|0000056789"), value = String::make_fill('v', 64);
+    std::vector<String> none, one(1, value), pairs;
+    for (int i = 0; i < 16; ++i)
+        pairs.push_back(key), pairs.push_back(value);
+
+    Json stats;
+    stats.set("get", run_rpc_decode_bench(
+        msgpack::unparse(Json::array(pq_get, 1, key)), one, false));
+    stats.set("insert", run_rpc_decode_bench(
+        msgpack::unparse(Json::array(pq_insert, 1, key, value)), none, false));
+    stats.set("erase", run_rpc_decode_bench(
+        msgpack::unparse(Json::array(pq_erase, 1, key)), none, false));
+    stats.set("count", run_rpc_decode_bench(
+        msgpack::unparse(Json::array(pq_count, 1, "t|", "t}")), none, false));
+    stats.set("scan", run_rpc_decode_bench(
+        msgpack::unparse(Json::array(pq_scan, 1, "t|", "t}", Json(), 16)),
+        pairs, true));
+    std::cout << stats.unparse(Json::indent_depth(4)) << "\n";
+}
+
+class RangeItem {
+  public:
+    RangeItem(Str first, Str last)
+        : ibegin_(first), iend_(last) {
+    }
+    typedef Str endpoint_type;
+    Str ibegin() const {
+        return ibegin_;
+    }
+    Str iend() const {
+        return iend_;
+    }
+    Str subtree_iend() const {
+        return subtree_iend_;
+    }
+    void set_subtree_iend(Str x) {
+        subtree_iend_ = x;
+    }
+    rblinks<RangeItem> rblinks_;
+  private:
+    LocalStr<24> ibegin_;
+    LocalStr<24> iend_;
+    Str subtree_iend_;
+};
+
+template <typename S>
+size_t count_stabbing(S& tree, Str key) {
+    size_t n = 0;
+    for (auto it = tree.begin_contains(key); it != tree.end(); ++it) {
+        mandatory_assert(it->ibegin() <= key && key < it->iend());
+        ++n;
+    }
+    return n;
+}
+
+void test_flat_interval_tree() {
+    boost::mt19937 gen(11);
+    flat_interval_tree<RangeItem> tree;
+    std::vector<RangeItem*> items;
+    char a[20], b[20];
+
+    for (int round = 0; round < 40; ++round) {
+        for (int i = 0; i < 200; ++i) {
+            unsigned x = gen() % 5000, len = gen() % 8 ? gen() % 20 : gen() % 2000;
+            sprintf(a, "k|%05u", x);
+            sprintf(b, "k|%05u", x + len);
+            items.push_back(new RangeItem(Str(a), Str(b)));
+            tree.insert(*items.back());
+        }
+        for (int i = 0; i < 120 && !items.empty(); ++i) {
+            size_t j = gen() % items.size();
+            tree.erase(*items[j]);
+            delete items[j];
+            items[j] = items.back();
+            items.pop_back();
+        }
+        for (int i = 0; i < 50; ++i) {
+            sprintf(a, "k|%05u", unsigned(gen() % 7000));
+            size_t expected = 0;
+            for (RangeItem* r : items)
+                expected += r->ibegin() <= Str(a) && Str(a) < r->iend();
+            CHECK_EQ(count_stabbing(tree, Str(a)), expected);
+        }
+    }
+
+    // erasing the current interval while iterating is allowed
+    sprintf(a, "k|%05u", 2500U);
+    size_t before = count_stabbing(tree, Str(a)), erased = 0;
+    for (auto it = tree.begin_contains(Str(a)); it != tree.end(); ) {
+        RangeItem* r = it.operator->();
+        ++it;
+        tree.erase(*r);
+        items.erase(std::find(items.begin(), items.end(), r));
+        delete r;
+        ++erased;
+    }
+    CHECK_EQ(erased, before);
+    CHECK_EQ(count_stabbing(tree, Str(a)), size_t(0));
+    CHECK_EQ(tree.size(), items.size());
+
+    // intervals inserted while iterating wait in the delta
+    sprintf(a, "k|%05u", 1000U);
+    before = count_stabbing(tree, Str(a));
+    size_t added = 0;
+    for (auto it = tree.begin_contains(Str(a)); it != tree.end(); ++it)
+        if (added != 40) {
+            items.push_back(new RangeItem(it->ibegin(), it->iend()));
+            tree.insert(*items.back());
+            ++added;
+        }
+    CHECK_EQ(count_stabbing(tree, Str(a)), before + added);
+
+    while (RangeItem* r = tree.unlink_leftmost_without_rebalance())
+        delete r;
+}
+
+template <typename S>
+double run_stabbing_bench(const std::vector<RangeItem*>& items,
+                          const std::vector<String>& probes) {
+    S tree;
+    struct rusage ru[2];
+    size_t found = 0;
+    for (RangeItem* r : items)
+        tree.insert(*r);
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (auto& k : probes)
+        found += count_stabbing(tree, k);
+    getrusage(RUSAGE_SELF, &ru[1]);
+    mandatory_assert(found);
+    while (tree.unlink_leftmost_without_rebalance())
+        /* do nothing */;
+    return probes.size() / to_real(ru[1].ru_utime - ru[0].ru_utime);
+}
+
+// Base writes that fan out to timelines, as Table::notify sees them: one
+// source range per (follower, poster) pair.
+void test_notify_bench() {
+    const int nusers = 20000, nfollow = 50, nprobes = 200000, nposts = 50000;
+    boost::mt19937 gen(13);
+    char buf[64], buf2[64];
+
+    std::vector<RangeItem*> items;
+    std::vector<String> probes;
+    for (int u = 0; u < nusers; ++u)
+        for (int f = 0; f < nfollow; ++f) {
+            unsigned p = gen() % nusers, t = gen() % 1000;
+            sprintf(buf, "p|%05u|%010u", p, t);
+            sprintf(buf2, "p|%05u}", p);
+            items.push_back(new RangeItem(Str(buf), Str(buf2)));
+        }
+    for (int i = 0; i < nprobes; ++i) {
+        sprintf(buf, "p|%05u|%010u", unsigned(gen() % nusers), 1000 + i);
+        probes.push_back(String(buf));
+    }
+
+    Json stats;
+    stats.set("stab_rbtree_per_sec",
+              run_stabbing_bench<interval_tree<RangeItem> >(items, probes));
+    stats.set("stab_flat_per_sec",
+              run_stabbing_bench<flat_interval_tree<RangeItem> >(items, probes));
+    for (RangeItem* r : items)
+        delete r;
+
+    // whole-server notify throughput for the configured source index
+    pq::Server server;
+    pq::Join j;
+    CHECK_TRUE(j.assign_parse("t|<user:5>|<time:10>|<poster:5> = "
+                              "copy p|<poster>|<time> "
+                              "using s|<user>|<poster>"));
+    j.ref();
+    server.add_join("t|", "t}", &j);
+    for (int u = 0; u < nusers / 10; ++u)
+        for (int f = 0; f < nfollow; ++f) {
+            sprintf(buf, "s|%05u|%05u", u, unsigned(gen() % (nusers / 10)));
+            server.insert(buf, "1");
+        }
+    for (int u = 0; u < nusers / 10; ++u) {
+        sprintf(buf, "t|%05u|", u);
+        sprintf(buf2, "t|%05u}", u);
+        server.validate(buf, buf2);
+    }
+
+    struct rusage ru[2];
+    getrusage(RUSAGE_SELF, &ru[0]);
+    for (int i = 0; i < nposts; ++i) {
+        sprintf(buf, "p|%05u|%010u", unsigned(gen() % (nusers / 10)), 1000 + i);
+        server.insert(buf, "post");
+    }
+    getrusage(RUSAGE_SELF, &ru[1]);
+    stats.set("server_notify_per_sec",
+              nposts / to_real(ru[1].ru_utime - ru[0].ru_utime));
+#if HAVE_FLAT_SOURCE_INDEX
+    stats.set("source_index", "flat");
+#else
+    stats.set("source_index", "rbtree");
+#endif
+    std::cout << stats.unparse(Json::indent_depth(4)) << "\n";
+}
+
+// Populate throughput, one key at a time and in batches, for posts from
+// random posters and for bursts from one poster.
+void test_insert_batch_bench() {
+    const int nusers = 2000, nfollow = 50, nposts = 100000, batch = 1000;
+    char buf[64], buf2[64];
+    Json stats;
+
+    for (int burst = 0; burst != 2; ++burst)
+        for (int batched = 0; batched != 2; ++batched) {
+            boost::mt19937 gen(13);
+            pq::Server server;
+            pq::Join j;
+            CHECK_TRUE(j.assign_parse("t|<user:5>|<time:10>|<poster:5> = "
+                                      "copy p|<poster>|<time> "
+                                      "using s|<user>|<poster>"));
+            j.ref();
+            server.add_join("t|", "t}", &j);
+            for (int u = 0; u < nusers; ++u)
+                for (int f = 0; f < nfollow; ++f) {
+                    sprintf(buf, "s|%05u|%05u", u, unsigned(gen() % nusers));
+                    server.insert(buf, "1");
+                }
+            for (int u = 0; u < nusers; ++u) {
+                sprintf(buf, "t|%05u|", u);
+                sprintf(buf2, "t|%05u}", u);
+                server.validate(buf, buf2);
+            }
+
+            std::vector<std::pair<String, String> > kvs;
+            struct rusage ru[2];
+            getrusage(RUSAGE_SELF, &ru[0]);
+            for (int i = 0; i < nposts; ++i) {
+                unsigned poster = burst ? (i / batch) % nusers : gen() % nusers;
+                sprintf(buf, "p|%05u|%010u", poster, 1000 + i);
+                if (!batched)
+                    server.insert(buf, "post");
+                else {
+                    kvs.emplace_back(buf, "post");
+                    if (kvs.size() == batch) {
+                        server.insert_batch(std::move(kvs));
+                        kvs.clear();
+                    }
+                }
+            }
+            getrusage(RUSAGE_SELF, &ru[1]);
+            sprintf(buf, "%s_%s_per_sec", burst ? "burst" : "random",
+                    batched ? "batch" : "single");
+            stats.set(buf, nposts / to_real(ru[1].ru_utime - ru[0].ru_utime));
+        }
+    std::cout << stats.unparse(Json::indent_depth(4)) << "\n";
+}
+
+void test_slab_allocator() {
+    std::vector<pq::Datum*> ds;
+    ds.reserve(10000);
+    String value("x");
+    uint64_t other = pq::mem_other_size;
+    for (int i = 0; i < 10000; ++i)
+        ds.push_back(new pq::Datum(Str("d|00000"), value));
+    uint64_t used = pq::mem_other_size - other;
+    if (pq::enable_memory_tracking)
+        CHECK_EQ(used, 10000 * sizeof(pq::Datum));
+
+    // freed slots are reused before the slab grows
+    pq::Datum* last = ds.back();
+    ds.pop_back();
+    delete last;
+    pq::Datum* d = new pq::Datum(Str("d|00001"));
+    CHECK_TRUE(d == last);
+    ds.push_back(d);
+
+    for (pq::Datum* x : ds)
+        delete x;
+    used = pq::mem_other_size - other;
+    CHECK_EQ(used, uint64_t(0));
+}
+
+void test_memory_accounting() {
+    uint64_t store = pq::mem_store_size;
+    void* p = pq::allocate(100, &pq::mem_store_size);
+    uint64_t used = pq::mem_store_size - store;
+    CHECK_TRUE(used >= 100);
+    pq::deallocate(p);
+    used = pq::mem_store_size - store;
+    CHECK_EQ(used, uint64_t(0));
+
+    uint64_t other = pq::mem_other_size;
+    void* x = ::operator new(1000);
+    used = pq::mem_other_size - other;
+    CHECK_TRUE(used >= 1000);
+    ::operator delete(x);
+    used = pq::mem_other_size - other;
+    CHECK_EQ(used, uint64_t(0));
+
+    other = pq::mem_other_size;
+    x = ::operator new(1000, &pq::mem_store_size);
+    used = pq::mem_store_size - store;
+    uint64_t other_used = pq::mem_other_size - other;
+    ::operator delete(x);
+    CHECK_TRUE(used >= 1000);
+    CHECK_EQ(other_used, uint64_t(0));
+    used = pq::mem_store_size - store;
+    CHECK_EQ(used, uint64_t(0));
+}
+
 } // namespace
 
 void test_string() {
@@ -1280,9 +2446,16 @@ void test_string() {
 
 extern void test_mpfd();
 extern void test_mpfd2();
+extern void test_mpfd_refs();
 extern void test_redis();
 extern void test_memcache();
 extern void test_postgres();
+extern void test_remote_eager_using();
+extern void test_remote_replicated();
+extern void test_remote_fetch_batch();
+extern void test_remote_notify_batch();
+extern void test_multiclient_single();
+extern void test_scan_paged();
 
 void unit_tests(const std::set<String> &testcases) {
     std::vector<std::pair<String, test_func> > tests_;
@@ -1296,7 +2469,9 @@ void unit_tests(const std::set<String> &testcases) {
     ADD_TEST(test_expansion);
     ADD_TEST(test_recursive);
     ADD_TEST(test_count);
+    ADD_TEST(test_count_subtables);
     ADD_TEST(test_annotation);
+    ADD_TEST(test_refresh_ahead);
     ADD_TEST(test_lazy_eager);
     ADD_TEST(test_join1);
     ADD_TEST(test_op_count);
@@ -1306,6 +2481,17 @@ void unit_tests(const std::set<String> &testcases) {
     ADD_TEST(test_op_sum);
     //ADD_TEST(test_op_bounds);
     ADD_TEST(test_partitioner_analyze);
+    ADD_TEST(test_relay_parent);
+    ADD_TEST(test_replicated_partitions);
+    ADD_TEST(test_binary_keys);
+    ADD_TEST(test_reverse_scan);
+    ADD_TEST(test_multi);
+    ADD_TEST(test_insert_batch);
+    ADD_TEST(test_invalidate_key);
+    ADD_TEST(test_invalidate_fanout);
+    ADD_TEST(test_adaptive_sink);
+    ADD_TEST(test_adaptive_park);
+    ADD_TEST(test_compact_scan);
     ADD_TEST(test_cross);
     ADD_TEST(test_iupdate);
     ADD_TEST(test_iupdate2);
@@ -1314,15 +2500,30 @@ void unit_tests(const std::set<String> &testcases) {
     ADD_TEST(test_iupdate_t);
     ADD_TEST(test_celebrity);
     ADD_TEST(test_string);
+    ADD_TEST(test_btree_store);
+    ADD_TEST(test_slab_allocator);
+    ADD_TEST(test_flat_interval_tree);
+    ADD_TEST(test_memory_accounting);
     ADD_EXP_TEST(test_karma);
     ADD_EXP_TEST(test_ma);
     ADD_EXP_TEST(test_swap);
     ADD_EXP_TEST(test_karma_online);
+    ADD_EXP_TEST(test_store_bench);
+    ADD_EXP_TEST(test_rpc_decode_bench);
+    ADD_EXP_TEST(test_notify_bench);
+    ADD_EXP_TEST(test_insert_batch_bench);
     ADD_OTHER_TEST(test_mpfd);
     ADD_OTHER_TEST(test_mpfd2);
+    ADD_OTHER_TEST(test_mpfd_refs);
     ADD_OTHER_TEST(test_redis);
     ADD_OTHER_TEST(test_memcache);
     ADD_OTHER_TEST(test_postgres);
+    ADD_OTHER_TEST(test_remote_eager_using);
+    ADD_OTHER_TEST(test_remote_replicated);
+    ADD_OTHER_TEST(test_remote_fetch_batch);
+    ADD_OTHER_TEST(test_remote_notify_batch);
+    ADD_OTHER_TEST(test_multiclient_single);
+    ADD_OTHER_TEST(test_scan_paged);
     size_t ntests = 0;
     for (auto& t : tests_)
         if (testcases.empty() || testcases.find(t.first) != testcases.end()) {
@@ -3,8 +3,15 @@
 #include "redisadapter.hh"
 #include "memcacheadapter.hh"
 #include "pqpersistent.hh"
+#include "pqserver.hh"
+#include "pqinterconnect.hh"
+#include "pqjoin.hh"
+#include "partitioner.hh"
+#include "pqmulticlient.hh"
 #include "check.hh"
 #include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
 
 namespace {
 void small_socket_buffer(int f) {
@@ -127,6 +134,64 @@ void test_mpfd2() {
         test_mpfd2_server(c2p[0], p2c[1]);
 }
 
+namespace {
+// len bytes that differ with msg and field, so misplaced bytes show
+String mpfd_refs_string(int msg, int field, int len) {
+    StringAccum sa(len);
+    for (int i = 0; i != len; ++i)
+        sa << char('a' + (msg * 7 + field * 3 + i) % 26);
+    return sa.take_string();
+}
+}
+
+// Strings of wrrefmin bytes and more are sent from their own memory with
+// writev. Through small socket buffers, writes stop inside them, and some
+// messages hold more of them than one writev takes.
+tamed void test_mpfd_refs() {
+    tvars {
+        int sv[2];
+        tamer::fd fd[2];
+        msgpack_fd* w;
+        msgpack_fd* r;
+        Json sent = Json::make_array(), j;
+        int i, k, nmsg = 40;
+    }
+    static const int lens[] = {0, 1, 255, 256, 257, 1000, 5000};
+
+    mandatory_assert(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    for (i = 0; i != 2; ++i) {
+        tamer::fd::make_nonblocking(sv[i]);
+        small_socket_buffer(sv[i]);
+        fd[i] = tamer::fd(sv[i]);
+    }
+    w = new msgpack_fd(fd[0]);
+    r = new msgpack_fd(fd[1]);
+    w->set_wrlowat(1);
+
+    for (i = 0; i != nmsg; ++i) {
+        j = Json::array(1, i);
+        if (i % 4 == 3)
+            // 100 refs, more than one writev's 64 iovecs
+            for (k = 0; k != 100; ++k)
+                j.push_back(mpfd_refs_string(i, k, 256 + k));
+        else
+            for (k = 0; k != int(sizeof(lens) / sizeof(lens[0])); ++k)
+                j.push_back(mpfd_refs_string(i, k, lens[(i + k) % 7]));
+        w->write(j);
+        sent.push_back(j);
+    }
+
+    for (i = 0; i != nmsg; ++i) {
+        twait { r->read_request(make_event(j)); }
+        CHECK_TRUE(j == sent[i]);
+    }
+
+    delete w;
+    delete r;
+    fd[0].close();
+    fd[1].close();
+}
+
 #if HAVE_HIREDIS_HIREDIS_H
 tamed void test_redis() {
     tvars {
@@ -304,3 +369,325 @@ void test_postgres() {
 }
 #endif
 
+
+
+// in pqserverloop.tcc; declared here, outside the anonymous namespace
+void serve_interconnect(pq::Server& server, tamer::fd fd, pq::Interconnect* ic);
+
+namespace {
+// Two servers in one process, joined by a socketpair. partfunc names the
+// partition function, as --partfunc would; with "unit", keys starting
+// with a, c, s or Y belong to server 1 and keys starting with b, p or t
+// to server 0.
+class server_pair {
+  public:
+    explicit server_pair(const String& partfunc);
+    inline pq::Server& operator[](int i) {
+        return server_[i];
+    }
+    void close();
+  private:
+    pq::Server server_[2];
+    pq::Partitioner* part_;
+    int sv_[2];
+};
+
+server_pair::server_pair(const String& partfunc)
+    : part_(pq::Partitioner::make(partfunc, 2, 0)) {
+    int r = socketpair(AF_UNIX, SOCK_STREAM, 0, sv_);
+    mandatory_assert(r == 0);
+    for (int i = 0; i < 2; ++i) {
+        tamer::fd::make_nonblocking(sv_[i]);
+        tamer::fd fd(sv_[i]);
+        std::vector<pq::Interconnect*> ic(2, nullptr);
+        ic[1 - i] = new pq::Interconnect(fd, 1 - i);
+        server_[i].set_cluster_details(i, ic, part_);
+        serve_interconnect(server_[i], fd, ic[1 - i]);
+    }
+}
+
+// lets the connections, and so the event loop, finish
+void server_pair::close() {
+    for (int i = 0; i < 2; ++i)
+        shutdown(sv_[i], SHUT_RDWR);
+}
+}
+
+tamed void test_remote_eager_using() {
+    tvars {
+        server_pair* sp = new server_pair("unit");
+        pq::Join* j = new pq::Join;
+        pq::Table::iterator it;
+    }
+
+    (*sp)[0].insert("b|00002|0000000001", "b1");
+    (*sp)[0].insert("b|00002|0000000002", "b2");
+    (*sp)[0].insert("b|00003|0000000002", "b3");
+    (*sp)[0].insert("b|00003|0000000003", "b4");
+    (*sp)[1].insert("a|00001|00002", "1");
+
+    CHECK_TRUE(j->assign_parse("Y|<a_id>|<time>|<b_id> = "
+                               "using eager a|<a_id>|<b_id> "
+                               "copy b|<b_id>|<time> "
+                               "with a_id:5, b_id:5, time:10"));
+    j->ref();
+    (*sp)[1].add_join("Y|", "Y}", j);
+
+    twait { (*sp)[1].validate("Y|00001|0000000001", "Y|00001}", make_event(it)); }
+    CHECK_EQ((*sp)[1].count("Y|00001|0000000001", "Y|00001}"), size_t(2));
+
+    // the eager update must fetch b|00003 from server 0 by itself;
+    // count() does not validate
+    (*sp)[1].insert("a|00001|00003", "1");
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("Y|00001|0000000001", "Y|00001}"), size_t(4));
+
+    sp->close();
+}
+
+tamed void test_remote_replicated() {
+    tvars {
+        server_pair* sp = new server_pair("{\"partitions\":[],\"replicated\":[\"b|\"]}");
+    }
+
+    // server 0 owns everything; server 1 keeps a pinned copy of b|
+    (*sp)[0].insert("b|00001", "b1");
+    (*sp)[0].insert("b|00002", "b2");
+    (*sp)[1].replicate();
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|", "b}"), size_t(2));
+    CHECK_TRUE(!(*sp)[1].evict_one());
+
+    (*sp)[0].insert("b|00003", "b3");
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|", "b}"), size_t(3));
+
+    // an invalidated replica is fetched again, still pinned; the owner
+    // drops the subscription along with the invalidation
+    (*sp)[0].unsubscribe("b|", "b}", 1);
+    twait { (*sp)[0].interconnect(1)->invalidate("b|", "b}", make_event()); }
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_TRUE((*sp)[1].table_for("b|00001").has_remote("b|00001"));
+    CHECK_EQ((*sp)[1].count("b|", "b}"), size_t(3));
+    CHECK_TRUE(!(*sp)[1].evict_one());
+
+    (*sp)[0].insert("b|00004", "b4");
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|", "b}"), size_t(4));
+
+    sp->close();
+}
+
+// ranges fetched from one owner in the same pass go out as one
+// pq_subscribe_batch, and each comes back with its own contents
+tamed void test_remote_fetch_batch() {
+    tvars {
+        server_pair* sp = new server_pair("{\"partitions\":[],\"replicated\":[\"b|00001\",\"b|00003\",\"p|\"]}");
+    }
+
+    (*sp)[0].insert("b|00001|01", "b1");
+    (*sp)[0].insert("b|00001|02", "b2");
+    (*sp)[0].insert("b|00002|01", "x");
+    (*sp)[0].insert("b|00003|01", "b3");
+    (*sp)[0].insert("p|00001", "p1");
+    (*sp)[1].replicate();
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|00001", "b|00002"), size_t(2));
+    CHECK_EQ((*sp)[1].count("b|00002", "b|00003"), size_t(0));
+    CHECK_EQ((*sp)[1].count("b|00003", "b|00004"), size_t(1));
+    CHECK_EQ((*sp)[1].count("p|", "p}"), size_t(1));
+    CHECK_EQ((*sp)[1].find("b|00001|02")->value(), String("b2"));
+    CHECK_EQ((*sp)[1].find("b|00003|01")->value(), String("b3"));
+    CHECK_EQ((*sp)[1].find("p|00001")->value(), String("p1"));
+
+    // every range was subscribed to, not just the first
+    (*sp)[0].insert("b|00003|02", "b4");
+    (*sp)[0].insert("p|00002", "p2");
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|00003", "b|00004"), size_t(2));
+    CHECK_EQ((*sp)[1].count("p|", "p}"), size_t(2));
+
+    sp->close();
+}
+
+// writes to a subscribed key within notify_delay_usec reach the
+// subscriber as one update carrying the last value
+tamed void test_remote_notify_batch() {
+    tvars {
+        server_pair* sp = new server_pair("{\"partitions\":[],\"replicated\":[\"b|\"]}");
+        int i;
+        char buf[32];
+    }
+
+    (*sp)[0].insert("b|00001", "v0");
+    (*sp)[0].insert("b|00002", "e0");
+    (*sp)[1].replicate();
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].find("b|00001")->value(), String("v0"));
+
+    (*sp)[0].insert("b|00001", "v1");
+    (*sp)[0].insert("b|00001", "v2");
+    (*sp)[0].insert("b|00001", "v3");
+    (*sp)[0].insert("b|00002", "e1");
+    (*sp)[0].erase("b|00002");
+    (*sp)[0].insert("b|00003", "n1");
+    (*sp)[0].erase("b|00003");
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].find("b|00001")->value(), String("v3"));
+    CHECK_TRUE(!(*sp)[1].find("b|00002"));
+    CHECK_TRUE(!(*sp)[1].find("b|00003"));
+
+    // more keys than one batch holds are all delivered
+    for (i = 0; i != 600; ++i) {
+        sprintf(buf, "b|1%04d", i);
+        (*sp)[0].insert(buf, "x");
+    }
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].count("b|1", "b|2"), size_t(600));
+
+    // an invalidation sends the updates queued before it first
+    (*sp)[0].insert("b|00001", "v4");
+    twait { (*sp)[0].interconnect(1)->invalidate("b|", "b}", make_event()); }
+    twait { tamer::at_delay_msec(100, make_event()); }
+    CHECK_EQ((*sp)[1].find("b|00001")->value(), String("v4"));
+    CHECK_EQ((*sp)[1].count("b|", "b}"), size_t(601));
+
+    sp->close();
+}
+
+void serve_clients(pq::Server& server, tamer::fd listenfd);
+
+namespace {
+// Serves clients of server on a loopback port, which is returned in port.
+// Close the result to stop accepting.
+tamer::fd serve_loopback(pq::Server& server, int& port) {
+    tamer::fd listenfd = tamer::tcp_listen(0);
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    mandatory_assert(listenfd
+                     && getsockname(listenfd.value(), (struct sockaddr*) &sin,
+                                    &len) == 0);
+    port = ntohs(sin.sin_port);
+    serve_clients(server, listenfd);
+    return listenfd;
+}
+}
+
+// a MultiClient given only a port talks to one server, with no partitioner
+tamed void test_multiclient_single() {
+    tvars {
+        pq::Server* server = new pq::Server;
+        int port;
+        tamer::fd listenfd;
+        pq::MultiClient* mc;
+        String value;
+        std::vector<String> values;
+    }
+
+    listenfd = serve_loopback(*server, port);
+    mc = new pq::MultiClient(nullptr, nullptr, port);
+    twait { mc->connect(make_event()); }
+    twait { mc->insert("a|00001", "a1", make_event()); }
+    twait { mc->insert("b|00001", "b1", make_event()); }
+    twait { mc->get("a|00001", make_event(value)); }
+    CHECK_EQ(value, String("a1"));
+    twait { mc->get("a|00002", make_event(value)); }
+    CHECK_EQ(value, String());
+    twait { mc->get(std::vector<String>{"b|00001", "a|00001"},
+                    make_event(values)); }
+    CHECK_EQ(values.size(), size_t(2));
+    CHECK_EQ(values[0], String("b1"));
+    CHECK_EQ(values[1], String("a1"));
+
+    delete mc;
+    listenfd.close();
+}
+
+namespace {
+String paged_key(int i) {
+    char buf[32];
+    sprintf(buf, "t|%05d", i);
+    return String(buf);
+}
+
+// the pairs of a scan, in order, as one string
+String scan_keys(const pq::RemoteClient::scan_result& r) {
+    StringAccum sa;
+    for (auto it = r.begin(); it != r.end(); ++it)
+        sa << it->key() << '=' << it->value() << ' ';
+    return sa.take_string();
+}
+}
+
+// a limited scan returns a cursor just past its last key while pairs
+// remain, and the pages it leads to join into the whole range
+tamed void test_scan_paged() {
+    tvars {
+        pq::Server* server = new pq::Server;
+        int port;
+        tamer::fd listenfd, fd;
+        pq::RemoteClient* client;
+        pq::RemoteClient::scan_result res;
+        String first, want, got;
+        int n = pq_scan_max_pairs + 10;
+        int i, npages;
+    }
+
+    listenfd = serve_loopback(*server, port);
+    for (i = 0; i != n; ++i)
+        server->insert(paged_key(i), String(i));
+    server->insert("t|", "before");
+    server->insert("u|00000", "after");
+    twait { tamer::tcp_connect(in_addr{htonl(INADDR_LOOPBACK)}, port,
+                               make_event(fd)); }
+    client = new pq::RemoteClient(fd, "paged");
+
+    // ten keys in pages of four, three, and exactly the rest
+    for (i = 0; i != 10; ++i)
+        want += paged_key(i) + "=" + String(i) + " ";
+    twait { client->scan(paged_key(0), paged_key(10), paged_key(10), 4,
+                         make_event(res)); }
+    CHECK_EQ(res.size(), size_t(4));
+    CHECK_EQ(res.cursor(), paged_key(3) + String("\0", 1));
+    got = scan_keys(res);
+    twait { client->scan(res.cursor(), paged_key(10), paged_key(10), 3,
+                         make_event(res)); }
+    CHECK_EQ(res.size(), size_t(3));
+    got += scan_keys(res);
+    twait { client->scan(res.cursor(), paged_key(10), paged_key(10), 3,
+                         make_event(res)); }
+    CHECK_EQ(res.size(), size_t(3));
+    CHECK_TRUE(!res.cursor());
+    got += scan_keys(res);
+    CHECK_EQ(got, want);
+
+    // a limit of 0 is no limit
+    twait { client->scan(paged_key(0), paged_key(10), paged_key(10), 0,
+                         make_event(res)); }
+    CHECK_TRUE(!res.cursor());
+    CHECK_EQ(scan_keys(res), want);
+
+    // more pairs than one reply may hold, page by page and via scan_paged
+    want = String();
+    for (i = 0; i != n; ++i)
+        want += paged_key(i) + "=" + String(i) + " ";
+    got = String();
+    first = paged_key(0);
+    npages = 0;
+    do {
+        twait { client->scan(first, "t}", "t}", 1000, make_event(res)); }
+        got += scan_keys(res);
+        first = res.cursor();
+        ++npages;
+    } while (first);
+    CHECK_EQ(npages, (n + 999) / 1000);
+    CHECK_EQ(got, want);
+
+    twait { client->scan_paged(paged_key(0), "t}", "t}", make_event(res)); }
+    CHECK_EQ(res.size(), size_t(n));
+    CHECK_TRUE(!res.cursor());
+    CHECK_EQ(scan_keys(res), want);
+
+    delete client;
+    listenfd.close();
+}